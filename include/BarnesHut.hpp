@@ -0,0 +1,560 @@
+#ifndef BARNESHUT_H
+#define BARNESHUT_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "ThreadPool.hpp"
+
+
+// One cell of the quadtree. The 4 children of a node are stored next to each
+// other starting at firstChild, in the order (-x,-y), (+x,-y), (-x,+y), (+x,+y).
+// Every node owns the range [start, start + count) of QuadTree::bodyIndex.
+struct QuadNode {
+    glm::vec2 center;       // geometric center of the square cell
+    float halfSize;         // half of the cell's side length
+    glm::vec2 centerOfMass;
+    float mass;
+    float maxRadius;        // biggest body radius in the cell (for collision queries)
+    float quadrupole[3];    // sum m*s*s^T about the center of mass: xx, xy, yy
+    float octupole[4];      // sum m*s*s*s about the center of mass: xxx, xxy, xyy, yyy
+    int firstChild;         // -1 if this node is a leaf
+    int start;
+    int count;
+};
+
+
+class QuadTree {
+public:
+    std::vector<QuadNode> nodes;
+    std::vector<int> bodyIndex;     // indices into state->bodies, grouped by leaf
+
+    int leafCapacity = 8;           // max bodies kept in a leaf before it splits
+    int maxDepth = 16;              // stops splitting when bodies sit on top of each other (keys have 16 levels)
+    int multipoleOrder = 2;         // 0 = monopole, 2 = + quadrupole, 3 = + octupole
+    float refitGrowthLimit = 1.25f; // rebuild once refitting has grown the cells this much in total
+    unsigned int buildCount = 0;    // goes up on every full build, node indices only stay valid between builds
+
+    // Linear quadtree build: every body gets a Morton key (its cell index at the deepest level,
+    // x and y bits interleaved), the keys are radix sorted, and then the tree is made one level
+    // at a time. A node's bodies are a run of sorted keys sharing its prefix, so its 4 children
+    // are found with binary searches, and every node in a level can be split at the same time.
+    // Key order (y bit above x bit) is the same as the child order above.
+    void build(const std::vector<CelestialBody>& bodies, ThreadPool& pool) {
+        nodes.clear();
+        bodyIndex.clear();
+
+        glm::vec2 minPos(0.0f);
+        glm::vec2 maxPos(0.0f);
+        bool first = true;
+
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            if (!bodies[i].exists) continue;
+
+            bodyIndex.push_back((int)i);
+
+            if (first) {
+                minPos = maxPos = bodies[i].position;
+                first = false;
+            }
+            else {
+                minPos = glm::min(minPos, bodies[i].position);
+                maxPos = glm::max(maxPos, bodies[i].position);
+            }
+        }
+
+        // Root is a square around every body (a little padded so nothing sits on the edge)
+        QuadNode root;
+        root.center = (minPos + maxPos) * 0.5f;
+        root.halfSize = std::max(maxPos.x - minPos.x, maxPos.y - minPos.y) * 0.5f + 0.001f;
+        root.firstChild = -1;
+        root.start = 0;
+        root.count = (int)bodyIndex.size();
+        nodes.push_back(root);
+
+        const int count = root.count;
+        const int block = 4096;
+        const int blockCount = (count + block - 1) / block;
+
+        // Morton keys
+        keys.resize(count);
+        const glm::vec2 corner = root.center - root.halfSize;
+        const float toCell = MORTON_CELLS / (2.0f * root.halfSize);
+        pool.parallelFor(blockCount, [&](int t) {
+            int end = std::min(count, (t + 1) * block);
+            for (int k = t * block; k < end; ++k) {
+                glm::vec2 cell = (bodies[bodyIndex[k]].position - corner) * toCell;
+                unsigned int x = (unsigned int)std::min(std::max(cell.x, 0.0f), MORTON_CELLS - 1.0f);
+                unsigned int y = (unsigned int)std::min(std::max(cell.y, 0.0f), MORTON_CELLS - 1.0f);
+                keys[k] = spreadBits(x) | (spreadBits(y) << 1);
+            }
+        });
+
+        radixSort(pool);
+
+        // Split level by level, top down
+        std::vector<int> levelStarts = { 0 };
+        int levelBegin = 0;
+        int levelEnd = 1;
+        for (int depth = 0; levelBegin < levelEnd; ++depth) {
+            const int levelSize = levelEnd - levelBegin;
+            const int shift = 2 * (MORTON_BITS - 1 - depth);
+            const bool canSplit = depth < std::min(maxDepth, MORTON_BITS);
+
+            splits.resize((size_t)levelSize * 5);
+            pool.parallelFor((levelSize + 255) / 256, [&](int t) {
+                int end = std::min(levelEnd, levelBegin + (t + 1) * 256);
+                for (int n = levelBegin + t * 256; n < end; ++n) {
+                    int* split = &splits[(size_t)(n - levelBegin) * 5];
+                    const QuadNode& node = nodes[n];
+                    if (node.count <= leafCapacity || !canSplit) {
+                        split[0] = -1;
+                        continue;
+                    }
+
+                    // Inside the node the keys only differ from this digit down, so it is sorted too
+                    split[0] = node.start;
+                    split[4] = node.start + node.count;
+                    for (int q = 1; q < 4; ++q) {
+                        auto it = std::partition_point(keys.begin() + split[q - 1], keys.begin() + split[4],
+                                                       [&](unsigned int key) { return (int)((key >> shift) & 3u) < q; });
+                        split[q] = (int)(it - keys.begin());
+                    }
+                }
+            });
+
+            // Children of the whole level go right after it, in order
+            int next = levelEnd;
+            for (int n = levelBegin; n < levelEnd; ++n) {
+                if (splits[(size_t)(n - levelBegin) * 5] < 0) continue;
+                nodes[n].firstChild = next;
+                next += 4;
+            }
+            nodes.resize(next);
+
+            pool.parallelFor((levelSize + 255) / 256, [&](int t) {
+                int end = std::min(levelEnd, levelBegin + (t + 1) * 256);
+                for (int n = levelBegin + t * 256; n < end; ++n) {
+                    const int* split = &splits[(size_t)(n - levelBegin) * 5];
+                    if (split[0] < 0) continue;
+
+                    const QuadNode& node = nodes[n];
+                    float childHalf = node.halfSize * 0.5f;
+                    for (int q = 0; q < 4; ++q) {
+                        QuadNode& child = nodes[node.firstChild + q];
+                        child.center = node.center + glm::vec2((q & 1) ? childHalf : -childHalf, (q & 2) ? childHalf : -childHalf);
+                        child.halfSize = childHalf;
+                        child.firstChild = -1;
+                        child.start = split[q];
+                        child.count = split[q + 1] - split[q];
+                    }
+                }
+            });
+
+            levelBegin = levelEnd;
+            levelEnd = next;
+            levelStarts.push_back(levelBegin);
+        }
+
+        // Moments, bottom up one level at a time
+        for (int level = (int)levelStarts.size() - 2; level >= 0; --level) {
+            const int begin = levelStarts[level];
+            const int end = levelStarts[level + 1];
+            pool.parallelFor((end - begin + 255) / 256, [&](int t) {
+                int last = std::min(end, begin + (t + 1) * 256);
+                for (int n = begin + t * 256; n < last; ++n) {
+                    if (nodes[n].firstChild < 0) {
+                        computeLeaf(bodies, n);
+                    }
+                    else {
+                        combineChildren(n);
+                    }
+                }
+            });
+        }
+
+        builtBodyCount = bodies.size();
+        builtCellSize = totalCellSize();
+        buildCount++;
+    }
+
+    // Refits the tree to where the bodies are now and only builds it from scratch when it has to:
+    // the bodies were added or removed (indices no longer line up) or the refitted cells have
+    // grown too much, which makes the walk open more cells than a fresh tree would.
+    // Returns true if it rebuilt.
+    bool update(const std::vector<CelestialBody>& bodies, bool bodiesChanged, ThreadPool& pool) {
+        if (nodes.empty() || bodiesChanged || bodies.size() != builtBodyCount) {
+            build(bodies, pool);
+            return true;
+        }
+
+        refit(bodies);
+
+        if (totalCellSize() > builtCellSize * refitGrowthLimit) {
+            build(bodies, pool);
+            return true;
+        }
+        return false;
+    }
+
+    // Keeps every node's bodies and children, but recomputes the moments bottom-up and grows
+    // each cell's square until it covers its bodies again. Cells never shrink here, so the
+    // opening test stays at least as strict as it was right after the build.
+    void refit(const std::vector<CelestialBody>& bodies) {
+        // Children are always stored after their parent, so going backwards is bottom-up
+        for (int n = (int)nodes.size() - 1; n >= 0; --n) {
+            QuadNode& node = nodes[n];
+            glm::vec2 minPos = node.center - node.halfSize;
+            glm::vec2 maxPos = node.center + node.halfSize;
+
+            if (node.firstChild < 0) {
+                for (int k = node.start; k < node.start + node.count; ++k) {
+                    minPos = glm::min(minPos, bodies[bodyIndex[k]].position);
+                    maxPos = glm::max(maxPos, bodies[bodyIndex[k]].position);
+                }
+                computeLeaf(bodies, n);
+            }
+            else {
+                for (int q = 0; q < 4; ++q) {
+                    const QuadNode& child = nodes[node.firstChild + q];
+                    minPos = glm::min(minPos, child.center - child.halfSize);
+                    maxPos = glm::max(maxPos, child.center + child.halfSize);
+                }
+                combineChildren(n);
+            }
+
+            node.center = (minPos + maxPos) * 0.5f;
+            node.halfSize = std::max(maxPos.x - minPos.x, maxPos.y - minPos.y) * 0.5f;
+        }
+    }
+
+    // Acceleration on bodies[self] from everything in the tree.
+    // A cell is approximated by its expansion (see cellAcceleration) when (cell size / distance) < theta.
+    // Mean relative force error on a 20k body disk:
+    //     theta        0.3      0.5      0.7      0.9
+    //     monopole     3.6e-3   1.1e-2   2.6e-2   4.7e-2
+    //     quadrupole   1.2e-4   1.0e-3   5.2e-3   1.4e-2
+    //     octupole     5.2e-5   5.4e-4   3.6e-3   1.0e-2
+    // so quadrupoles at theta 0.9 match a plain tree at 0.5 while opening about 3x fewer cells.
+    glm::vec2 accelerationOn(const std::vector<CelestialBody>& bodies, int self, float G, float theta, float softening) const {
+        glm::vec2 acceleration(0.0f);
+        if (nodes.empty()) return acceleration;
+
+        const glm::vec2 pos = bodies[self].position;
+        const float thetaSq = theta * theta;
+
+        int stack[4 * 64 + 4];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const QuadNode& node = nodes[stack[--stackSize]];
+            if (node.count == 0 || node.mass <= 0.0f) continue;
+
+            if (node.firstChild < 0) {
+                // Leaf: sum the bodies directly
+                for (int k = node.start; k < node.start + node.count; ++k) {
+                    int j = bodyIndex[k];
+                    if (j == self) continue;
+                    acceleration += pointMassAcceleration(bodies[j].position - pos, bodies[j].mass, G, softening);
+                }
+                continue;
+            }
+
+            glm::vec2 direction = node.centerOfMass - pos;
+            float distanceSq = glm::dot(direction, direction);
+            float size = node.halfSize * 2.0f;
+
+            // Never approximate a cell we are inside of, its center of mass can be right next to us
+            bool inside = std::abs(pos.x - node.center.x) <= node.halfSize && std::abs(pos.y - node.center.y) <= node.halfSize;
+
+            if (!inside && size * size < thetaSq * distanceSq) {
+                acceleration += cellAcceleration(node, direction, G, softening);
+            }
+            else {
+                for (int c = 0; c < 4; ++c) {
+                    stack[stackSize++] = node.firstChild + c;
+                }
+            }
+        }
+
+        return acceleration;
+    }
+
+    // Appends every body j > self whose circle overlaps bodies[self].
+    // Only j > self is reported so each pair shows up once, like the i < j order of the direct loop.
+    // laterOnly = false reports every j != self, for when only some bodies get asked.
+    void findOverlaps(const std::vector<CelestialBody>& bodies, int self, std::vector<int>& out, bool laterOnly = true) const {
+        if (nodes.empty()) return;
+
+        const glm::vec2 pos = bodies[self].position;
+        const float radius = bodies[self].radius;
+
+        int stack[4 * 64 + 4];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const QuadNode& node = nodes[stack[--stackSize]];
+            if (node.count == 0) continue;
+
+            // Skip cells whose box (grown by the largest radius inside) can't touch us
+            float reach = node.halfSize + node.maxRadius + radius;
+            if (std::abs(pos.x - node.center.x) > reach || std::abs(pos.y - node.center.y) > reach) continue;
+
+            if (node.firstChild < 0) {
+                for (int k = node.start; k < node.start + node.count; ++k) {
+                    int j = bodyIndex[k];
+                    if (j == self || (laterOnly && j < self)) continue;
+
+                    glm::vec2 delta = bodies[j].position - pos;
+                    float radiusSum = bodies[j].radius + radius;
+                    if (glm::dot(delta, delta) < radiusSum * radiusSum) {
+                        out.push_back(j);
+                    }
+                }
+                continue;
+            }
+
+            for (int c = 0; c < 4; ++c) {
+                stack[stackSize++] = node.firstChild + c;
+            }
+        }
+    }
+
+private:
+    static const int MORTON_BITS = 16;                 // bits per axis, so keys fit in 32 bits
+    static constexpr float MORTON_CELLS = 65536.0f;    // 2^MORTON_BITS
+
+    size_t builtBodyCount = 0;
+    float builtCellSize = 0.0f;
+
+    std::vector<unsigned int> keys;     // Morton key of bodyIndex[k], sorted after build
+    std::vector<unsigned int> keysTemp;
+    std::vector<int> indexTemp;
+    std::vector<int> splits;            // child ranges of the level being split, 5 per node
+    std::vector<int> digitCounts;
+
+    // 0b1111 -> 0b01010101, puts a zero bit in front of every bit
+    static unsigned int spreadBits(unsigned int v) {
+        v = (v | (v << 8)) & 0x00FF00FFu;
+        v = (v | (v << 4)) & 0x0F0F0F0Fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+        return v;
+    }
+
+    // LSD radix sort of keys (with bodyIndex riding along), 8 bits per pass.
+    // Each block counts its digits, a prefix sum over (digit, block) tells every block where
+    // to write, and the blocks scatter in parallel. Stable, so the result doesn't depend on threads.
+    void radixSort(ThreadPool& pool) {
+        const int count = (int)keys.size();
+        const int block = 16384;
+        const int blockCount = std::max(1, (count + block - 1) / block);
+
+        keysTemp.resize(count);
+        indexTemp.resize(count);
+        digitCounts.resize((size_t)blockCount * 256);
+
+        for (int shift = 0; shift < 32; shift += 8) {
+            pool.parallelFor(blockCount, [&](int t) {
+                int* counts = &digitCounts[(size_t)t * 256];
+                std::fill(counts, counts + 256, 0);
+                int end = std::min(count, (t + 1) * block);
+                for (int k = t * block; k < end; ++k) {
+                    counts[(keys[k] >> shift) & 255u]++;
+                }
+            });
+
+            // Keys all share this digit (common for the top bits): nothing moves
+            bool allSame = false;
+            for (int d = 0; d < 256 && !allSame; ++d) {
+                int total = 0;
+                for (int t = 0; t < blockCount; ++t) total += digitCounts[(size_t)t * 256 + d];
+                allSame = total == count;
+            }
+            if (allSame) continue;
+
+            int offset = 0;
+            for (int d = 0; d < 256; ++d) {
+                for (int t = 0; t < blockCount; ++t) {
+                    int n = digitCounts[(size_t)t * 256 + d];
+                    digitCounts[(size_t)t * 256 + d] = offset;
+                    offset += n;
+                }
+            }
+
+            pool.parallelFor(blockCount, [&](int t) {
+                int* offsets = &digitCounts[(size_t)t * 256];
+                int end = std::min(count, (t + 1) * block);
+                for (int k = t * block; k < end; ++k) {
+                    int dest = offsets[(keys[k] >> shift) & 255u]++;
+                    keysTemp[dest] = keys[k];
+                    indexTemp[dest] = bodyIndex[k];
+                }
+            });
+
+            keys.swap(keysTemp);
+            bodyIndex.swap(indexTemp);
+        }
+    }
+
+    float totalCellSize() const {
+        float total = 0.0f;
+        for (const QuadNode& node : nodes) {
+            total += node.halfSize;
+        }
+        return total;
+    }
+
+    // Same force law as the direct sum: G*m / (r^2 + softening) along the unit direction
+    static glm::vec2 pointMassAcceleration(glm::vec2 direction, float mass, float G, float softening) {
+        float distanceSq = glm::dot(direction, direction);
+        if (distanceSq <= 0.0f) return glm::vec2(0.0f);
+
+        float distance = std::sqrt(distanceSq);
+        return direction * (G * mass / ((distanceSq + softening) * distance));
+    }
+
+    // Pull of a whole cell, direction = centerOfMass - pos.
+    // A point mass pulls with a(r) = -G m r g(|r|), g = 1 / (r^3 + softening * r), r = pos - centerOfMass
+    // (the law of pointMassAcceleration). Expanding that in the body offsets s around the center of
+    // mass (where the dipole vanishes) adds
+    //     quadrupole:  -G/2 [ (2 S.r + tr(S) r) p + (r.S.r) q r ]
+    //     octupole:     G/6 [ 3 V p + 3 (W + (r.V) r) q + (r.W) t r ]
+    // with W_i = O_ijk r_j r_k, V_i = O_ijj and p, q, t from kernelDerivatives. With no softening these
+    // are the usual 1/r multipole terms. Keeping the softening in matters in dense clumps, where cells
+    // are accepted closer than sqrt(softening) and unsoftened terms would swamp the softened monopole.
+    glm::vec2 cellAcceleration(const QuadNode& node, glm::vec2 direction, float G, float softening) const {
+        glm::vec2 acceleration = pointMassAcceleration(direction, node.mass, G, softening);
+        if (multipoleOrder < 2) return acceleration;
+
+        const glm::dvec2 r = -glm::dvec2(direction);
+        const double r2 = glm::dot(r, r);
+        if (r2 <= 0.0) return acceleration;
+
+        double p, q, t;
+        kernelDerivatives(r2, softening, p, q, t);
+
+        const float* S = node.quadrupole;
+        glm::dvec2 Sr(S[0] * r.x + S[1] * r.y, S[1] * r.x + S[2] * r.y);
+        double rSr = glm::dot(r, Sr);
+        double trace = S[0] + S[2];
+
+        glm::dvec2 sum = -0.5 * ((2.0 * Sr + trace * r) * p + rSr * q * r);
+
+        if (multipoleOrder >= 3) {
+            const float* O = node.octupole;
+
+            glm::dvec2 W(O[0] * r.x * r.x + 2.0 * O[1] * r.x * r.y + O[2] * r.y * r.y,
+                         O[1] * r.x * r.x + 2.0 * O[2] * r.x * r.y + O[3] * r.y * r.y);
+            glm::dvec2 V(O[0] + O[2], O[1] + O[3]);
+            double rV = glm::dot(r, V);
+
+            sum += (3.0 * V * p + 3.0 * (W + rV * r) * q + glm::dot(r, W) * t * r) / 6.0;
+        }
+
+        return acceleration + glm::vec2(sum * (double)G);
+    }
+
+    // Radial derivatives of the point mass kernel g(r) = 1 / (r^3 + softening * r):
+    // p = g'/r, q = p'/r, t = q'/r, worked out so nothing cancels (every term has the same sign)
+    static void kernelDerivatives(double distanceSq, double softening, double& p, double& q, double& t) {
+        double r2 = distanceSq;
+        double e = softening;
+        double inv = 1.0 / std::sqrt(r2);
+        double w = 1.0 / (r2 + e);
+        double inv2 = inv * inv;
+
+        p = -(3.0 * r2 + e) * inv2 * inv * w * w;
+        q = (15.0 * r2 * r2 + 10.0 * e * r2 + 3.0 * e * e) * inv2 * inv2 * inv * w * w * w;
+        t = -(105.0 * r2 * r2 * r2 + 105.0 * e * r2 * r2 + 63.0 * e * e * r2 + 15.0 * e * e * e) * inv2 * inv2 * inv2 * inv * w * w * w * w;
+    }
+
+    // Combine the 4 children into this node's monopole and moments
+    void combineChildren(int nodeIdx) {
+        const int firstChild = nodes[nodeIdx].firstChild;
+
+        float mass = 0.0f;
+        float maxRadius = 0.0f;
+        glm::vec2 weighted(0.0f);
+        for (int q = 0; q < 4; ++q) {
+            const QuadNode& child = nodes[firstChild + q];
+            mass += child.mass;
+            weighted += child.centerOfMass * child.mass;
+            maxRadius = std::max(maxRadius, child.maxRadius);
+        }
+
+        QuadNode& self = nodes[nodeIdx];
+        self.mass = mass;
+        self.centerOfMass = mass > 0.0f ? weighted / mass : self.center;
+        self.maxRadius = maxRadius;
+
+        // Shift the children's moments over to our center of mass (parallel axis theorem)
+        clearMoments(self);
+        for (int q = 0; q < 4; ++q) {
+            const QuadNode& child = nodes[firstChild + q];
+            if (child.mass <= 0.0f) continue;
+
+            glm::vec2 d = child.centerOfMass - self.centerOfMass;
+            const float* S = child.quadrupole;
+            const float* O = child.octupole;
+
+            self.quadrupole[0] += S[0] + child.mass * d.x * d.x;
+            self.quadrupole[1] += S[1] + child.mass * d.x * d.y;
+            self.quadrupole[2] += S[2] + child.mass * d.y * d.y;
+
+            // O_ijk + S_ij d_k + S_ik d_j + S_jk d_i + m d_i d_j d_k
+            self.octupole[0] += O[0] + 3.0f * S[0] * d.x + child.mass * d.x * d.x * d.x;
+            self.octupole[1] += O[1] + 2.0f * S[1] * d.x + S[0] * d.y + child.mass * d.x * d.x * d.y;
+            self.octupole[2] += O[2] + 2.0f * S[1] * d.y + S[2] * d.x + child.mass * d.x * d.y * d.y;
+            self.octupole[3] += O[3] + 3.0f * S[2] * d.y + child.mass * d.y * d.y * d.y;
+        }
+    }
+
+    static void clearMoments(QuadNode& node) {
+        for (int k = 0; k < 3; ++k) node.quadrupole[k] = 0.0f;
+        for (int k = 0; k < 4; ++k) node.octupole[k] = 0.0f;
+    }
+
+    void computeLeaf(const std::vector<CelestialBody>& bodies, int nodeIdx) {
+        QuadNode& node = nodes[nodeIdx];
+
+        float mass = 0.0f;
+        float maxRadius = 0.0f;
+        glm::vec2 weighted(0.0f);
+        for (int k = node.start; k < node.start + node.count; ++k) {
+            const CelestialBody& body = bodies[bodyIndex[k]];
+            mass += body.mass;
+            weighted += body.position * body.mass;
+            maxRadius = std::max(maxRadius, body.radius);
+        }
+
+        node.mass = mass;
+        node.centerOfMass = mass > 0.0f ? weighted / mass : node.center;
+        node.maxRadius = maxRadius;
+
+        clearMoments(node);
+        for (int k = node.start; k < node.start + node.count; ++k) {
+            const CelestialBody& body = bodies[bodyIndex[k]];
+            glm::vec2 s = body.position - node.centerOfMass;
+            float m = body.mass;
+
+            node.quadrupole[0] += m * s.x * s.x;
+            node.quadrupole[1] += m * s.x * s.y;
+            node.quadrupole[2] += m * s.y * s.y;
+
+            node.octupole[0] += m * s.x * s.x * s.x;
+            node.octupole[1] += m * s.x * s.x * s.y;
+            node.octupole[2] += m * s.x * s.y * s.y;
+            node.octupole[3] += m * s.y * s.y * s.y;
+        }
+    }
+};
+
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "DirectSum.hpp"
+#include "SimdKernel.hpp"
+#include "BarnesHut.hpp"
+#include "HashGrid.hpp"
+#include "SweepAndPrune.hpp"
+#include "BoxTree.hpp"
+#include "Parareal.hpp"
+#include "Kepler.hpp"
+
+
+// Random bodies in a disk, a few of them debris, for timing the solvers without a window
+std::vector<CelestialBody> makeBenchmarkBodies(int count) {
+    std::vector<CelestialBody> bodies;
+    bodies.reserve(count);
+
+    srand(12345);
+    for (int i = 0; i < count; ++i) {
+        float r = std::sqrt((float)rand() / RAND_MAX) * 10.0f;
+        float angle = (float)rand() / RAND_MAX * 6.2831853f;
+        float mass = 0.5f + (float)rand() / RAND_MAX;
+
+        char id[32];
+        snprintf(id, sizeof(id), "Bench_%d", i);
+        bodies.emplace_back(id, glm::vec2(r * std::cos(angle), r * std::sin(angle)), mass, 0.001f, glm::vec4(1.0f), i % 10 == 0);
+    }
+    return bodies;
+}
+
+
+// Milliseconds per call, best of a few runs
+template <typename Fn>
+double timeBest(Fn fn, int runs) {
+    double best = 1e30;
+    for (int r = 0; r < runs; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    return best;
+}
+
+
+// Scalar symmetric kernel vs the SIMD kernel, single threaded, and how far apart they land
+void runDirectSumBenchmark(int count) {
+    const float G = 0.01f;
+    const float softening = 0.01f;
+    const double tolerance = 1e-4; // max difference we accept from the vector kernel, relative to RMS acceleration
+
+    std::vector<CelestialBody> bodies = makeBenchmarkBodies(count);
+
+    std::vector<glm::vec2> scalarAcc, simdAcc;
+    std::vector<std::pair<int, int>> overlaps;
+    BodyArrays soa;
+    ThreadPool singleThread;
+
+    double scalarMs = timeBest([&]() { computeDirectSymmetric(bodies, G, softening, scalarAcc, overlaps); }, 3);
+    double simdMs = timeBest([&]() { computeDirectSimd(bodies, G, softening, singleThread, soa, simdAcc, overlaps); }, 3);
+
+    // Bodies near the middle of the disk have tiny net pulls that float round-off dominates,
+    // so differences are measured against the RMS acceleration rather than each body's own
+    double sumSq = 0.0;
+    for (int i = 0; i < count; ++i) {
+        sumSq += glm::dot(scalarAcc[i], scalarAcc[i]);
+    }
+    double rms = std::sqrt(sumSq / std::max(1, count));
+
+    double worst = 0.0;
+    for (int i = 0; i < count; ++i) {
+        worst = std::max(worst, (double)glm::length(simdAcc[i] - scalarAcc[i]));
+    }
+    if (rms > 0.0) worst /= rms;
+
+    printf("Direct sum benchmark, %d bodies\n", count);
+    printf("  scalar symmetric:  %9.2f ms\n", scalarMs);
+    printf("  SIMD (%2d lanes):   %9.2f ms  (%.2fx)\n", GRAVITY_SIMD_LANES, simdMs, scalarMs / simdMs);
+    printf("  max difference / RMS acceleration: %.2e (tolerance %.0e) %s\n", worst, tolerance, worst <= tolerance ? "PASS" : "FAIL");
+}
+
+
+// Parareal against the fine integrator run serially: a star and count light bodies on
+// circular orbits, 3 orbits of the innermost. Yoshida 4 at 0.01 is the fine integrator,
+// leapfrog at 0.1 the coarse one. The parareal line is wall time measured with threadCount
+// threads. The line after it is a model, not a measurement: what one core per slice would
+// take, counted as the coarse sweeps plus one fine slice per iteration.
+void runPararealBenchmark(int count, int threadCount) {
+    const float G = 0.01f;
+    const float softening = 0.01f;
+    const double window = 20.0;
+    static const double yoshida4[3] = { 1.35120719195965763, -1.70241438391931527, 1.35120719195965763 };
+
+    std::vector<CelestialBody> bodies;
+    srand(12345);
+    bodies.emplace_back("Bench_star", glm::vec2(0.0f), 100.0f, 0.5f, glm::vec4(1.0f));
+    for (int i = 0; i < count; ++i) {
+        float r = 1.0f + (float)rand() / RAND_MAX * 9.0f;
+        float angle = (float)rand() / RAND_MAX * 6.2831853f;
+
+        char id[32];
+        snprintf(id, sizeof(id), "Bench_%d", i);
+        bodies.emplace_back(id, glm::vec2(r * std::cos(angle), r * std::sin(angle)), 0.001f, 0.001f, glm::vec4(1.0f));
+        bodies.back().velocity = glm::vec2(-std::sin(angle), std::cos(angle)) * std::sqrt(G * 100.0f / r);
+    }
+
+    Parareal parareal;
+    parareal.slices = 16;
+    parareal.maxIterations = 16;
+    parareal.fineStep = 0.01;
+    parareal.fineWeights = yoshida4;
+    parareal.fineStages = 3;
+    parareal.coarseStep = 0.1;
+
+    ThreadPool pool;
+    pool.resize(threadCount);
+
+    std::vector<CelestialBody> serial = bodies;
+    std::vector<CelestialBody> parallel = bodies;
+    std::vector<CelestialBody> coarseOnly = bodies;
+
+    double serialMs = timeBest([&]() { serial = bodies; parareal.runSerial(serial, G, softening, window); }, 1);
+    double pararealMs = timeBest([&]() { parallel = bodies; parareal.run(parallel, G, softening, window, pool); }, 1);
+    const int iterations = parareal.lastIterations;
+    const double change = parareal.lastChange;
+
+    parareal.maxIterations = 0;
+    double coarseMs = timeBest([&]() { coarseOnly = bodies; parareal.run(coarseOnly, G, softening, window, pool); }, 1);
+
+    double worst = 0.0;
+    double coarseWorst = 0.0;
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        worst = std::max(worst, (double)glm::length(parallel[i].position - serial[i].position));
+        coarseWorst = std::max(coarseWorst, (double)glm::length(coarseOnly[i].position - serial[i].position));
+    }
+
+    double criticalMs = coarseMs * (iterations + 1) + iterations * serialMs / parareal.slices;
+
+    printf("Parareal benchmark, %d bodies around a star, %d slices, %d threads\n", count, parareal.slices, pool.size());
+    printf("  serial fine:       %9.2f ms\n", serialMs);
+    printf("  parareal:          %9.2f ms  (%.2fx measured on %d threads, %d iterations, last change %.1e)\n", pararealMs, serialMs / pararealMs,
+           pool.size(), iterations, change);
+    printf("  one core a slice:  %9.2f ms  (%.2fx, modelled, not measured)\n", criticalMs, serialMs / criticalMs);
+    printf("  max distance from the serial run: %.2e (coarse alone %.2e) %s\n", worst, coarseWorst, worst <= 1e-5 ? "PASS" : "FAIL");
+}
+
+
+// The Kepler drift on random orbits around mu = 1, r and v from 0.01 to 100 and steps from
+// 0.01 to 1e4, so plenty of them are the long hyperbolic steps keplerDrift gives up on. Counts
+// how keplerDriftInPieces got each one through and checks the energy kept by the ones done in
+// pieces; the straight ones have to be unbound. Then a body sitting on the central mass, which never converges.
+void runKeplerBenchmark(int count) {
+    const double mu = 1.0;
+    auto energy = [&](glm::dvec2 p, glm::dvec2 v) { return 0.5 * glm::dot(v, v) - mu / glm::length(p); };
+
+    srand(12345);
+    auto logUniform = [](double low, double decades) { return low * std::pow(10.0, (double)rand() / RAND_MAX * decades); };
+
+    int inOne = 0, inPieces = 0, straight = 0, straightBound = 0;
+    double worstOne = 0.0, worstPieces = 0.0;
+    for (int i = 0; i < count; ++i) {
+        double r = logUniform(0.01, 4.0), v = logUniform(0.01, 4.0), dt = logUniform(0.01, 6.0);
+        double a = (double)rand() / RAND_MAX * 6.2831853, b = (double)rand() / RAND_MAX * 6.2831853;
+        glm::dvec2 position(r * std::cos(a), r * std::sin(a)), velocity(v * std::cos(b), v * std::sin(b));
+        double before = energy(position, velocity);
+        double scale = 0.5 * v * v + mu / r; // near parabolic the energy itself is about 0
+
+        int pieces = keplerDriftInPieces(position, velocity, mu, dt);
+        if (pieces == 0) {
+            straight++;
+            if (before < 0.0) straightBound++;
+            continue;
+        }
+        double change = std::abs(energy(position, velocity) - before) / scale;
+        if (pieces == 1) {
+            inOne++;
+            worstOne = std::max(worstOne, change);
+        }
+        else {
+            inPieces++;
+            worstPieces = std::max(worstPieces, change);
+        }
+    }
+
+    printf("Kepler drift benchmark, %d random orbits\n", count);
+    printf("  in one go:         %d  (worst energy change %.1e, over up to a million orbits)\n", inOne, worstOne);
+    printf("  in pieces:         %d  (worst energy change %.1e) %s\n", inPieces, worstPieces, worstPieces <= 1e-9 ? "PASS" : "FAIL");
+    printf("  straight line:     %d (%d of them bound) %s\n", straight, straightBound, straightBound == 0 ? "PASS" : "FAIL");
+
+    glm::dvec2 position(0.0), velocity(0.3, -0.4);
+    bool failed = !keplerDrift(position, velocity, mu, 2.0);
+    int pieces = keplerDriftInPieces(position, velocity, mu, 2.0);
+    bool moved = glm::length(position - glm::dvec2(0.6, -0.8)) < 1e-12;
+    printf("  body on the central mass: drift %s, %s %s\n", failed ? "fails" : "converges",
+           pieces == 0 ? "goes straight" : "converges in pieces", failed && pieces == 0 && moved ? "PASS" : "FAIL");
+}
+
+
+
+// A star, planets with the usual radius = 0.05 sqrt(mass) and lots of small debris, all
+// going around in a disk at roughly their circular speed. Packed so a few touch. With
+// wideRadii the planets' masses go from 0.5 to 400, radii from 0.035 to 1.
+std::vector<CelestialBody> makeCollisionBodies(int count, bool wideRadii = false) {
+    std::vector<CelestialBody> bodies;
+    bodies.reserve(count);
+
+    srand(12345);
+    const float disk = std::sqrt((float)count) * 0.15f;
+    bodies.emplace_back("Bench_star", glm::vec2(0.0f), 100.0f, 0.5f, glm::vec4(1.0f));
+    for (int i = 1; i < count; ++i) {
+        float r = 0.6f + std::sqrt((float)rand() / RAND_MAX) * disk;
+        float angle = (float)rand() / RAND_MAX * 6.2831853f;
+        bool debris = i % 10 != 0;
+        float spread = debris ? 0.0f : (float)rand() / RAND_MAX;
+        float mass = debris ? 0.01f : wideRadii ? 0.5f * std::pow(800.0f, spread) : 0.5f + spread * 3.5f;
+
+        char id[32];
+        snprintf(id, sizeof(id), "Bench_%d", i);
+        bodies.emplace_back(id, glm::vec2(r * std::cos(angle), r * std::sin(angle)), mass,
+                            debris ? 0.01f : 0.05f * std::sqrt(mass), glm::vec4(1.0f), debris);
+        bodies.back().velocity = glm::vec2(-std::sin(angle), std::cos(angle)) * std::sqrt(0.01f * 100.0f / r);
+    }
+    return bodies;
+}
+
+
+// The collision broadphases over a number of steps of the bodies drifting along, each
+// finding every touching pair (debris against debris left out, like the solvers do). The
+// pairs have to come out the same as the quadtree's.
+void runCollisionBenchmark(int count, int threadCount, bool wideRadii) {
+    const int steps = 50;
+    const float dt = 1.0f / 120.0f; // the default step
+
+    std::vector<CelestialBody> start = makeCollisionBodies(count, wideRadii);
+    ThreadPool pool;
+    pool.resize(threadCount);
+
+    // Quadtree, refit from the last step like detectCollisionsTree does
+    std::vector<std::vector<std::pair<int, int>>> treePairs(steps);
+    QuadTree tree;
+    std::vector<CelestialBody> bodies = start;
+    std::vector<int> overlaps;
+    double treeMs = timeBest([&]() {
+        bodies = start;
+        for (int s = 0; s < steps; ++s) {
+            tree.update(bodies, s == 0, pool);
+            treePairs[s].clear();
+            for (size_t i = 0; i < bodies.size(); ++i) {
+                overlaps.clear();
+                tree.findOverlaps(bodies, (int)i, overlaps);
+                for (int j : overlaps) {
+                    if (bodies[i].isDebris && bodies[j].isDebris) continue;
+                    treePairs[s].push_back(std::make_pair((int)i, j));
+                }
+            }
+            std::sort(treePairs[s].begin(), treePairs[s].end());
+            for (auto& body : bodies) body.position += body.velocity * dt;
+        }
+    }, 3);
+
+    size_t total = 0;
+    for (const auto& found : treePairs) total += found.size();
+
+    printf("Collision broadphase benchmark, %d bodies%s, %d steps, %d threads, %zu touching pairs\n", count,
+           wideRadii ? " (planet radii up to 1)" : "", steps, pool.size(), total);
+    printf("  quadtree (refit):  %9.3f ms a step\n", treeMs / steps);
+
+    // Anything else is timed the same way and checked against the tree
+    auto compare = [&](const char* name, auto&& findPairs) {
+        std::vector<std::pair<int, int>> pairs;
+        bool same = true;
+        double ms = timeBest([&]() {
+            bodies = start;
+            for (int s = 0; s < steps; ++s) {
+                findPairs(bodies, pairs);
+                same = same && pairs == treePairs[s];
+                for (auto& body : bodies) body.position += body.velocity * dt;
+            }
+        }, 3);
+        printf("  %-18s %9.3f ms a step  (%.2fx) %s\n", name, ms / steps, treeMs / ms, same ? "PASS" : "FAIL");
+    };
+
+    HashGrid grid;
+    compare("hash grid:", [&](std::vector<CelestialBody>& current, std::vector<std::pair<int, int>>& pairs) {
+        grid.build(current);
+        grid.findPairs(current, pool, pairs);
+    });
+
+    SweepAndPrune sweep;
+    compare("sweep and prune:", [&](std::vector<CelestialBody>& current, std::vector<std::pair<int, int>>& pairs) {
+        sweep.update(current);
+        sweep.findPairs(current, pairs);
+    });
+
+    BoxTree boxTree;
+    compare("box tree:", [&](std::vector<CelestialBody>& current, std::vector<std::pair<int, int>>& pairs) {
+        boxTree.update(current, 10.0f * dt);
+        boxTree.findPairs(current, pairs);
+    });
+}
+
+
+void runCollisionBenchmark(int count, int threadCount) {
+    runCollisionBenchmark(count, threadCount, false);
+    runCollisionBenchmark(count, threadCount, true);
+}
+
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef DIRECTSUM_H
+#define DIRECTSUM_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "ThreadPool.hpp"
+#include "Ewald.hpp"
+
+
+// Direct summation that visits every unordered pair once and applies the force to both
+// bodies (Newton's third law), so it costs half of the i x j loop.
+//
+// Accelerations are added into acc[], and pairs whose circles overlap are appended to
+// overlaps (as i < j) so the caller can run handleCollisions on them afterwards.
+// Rows are handed out as i = first, first + step, ... so threads get an even share of the triangle.
+// With an Ewald table every pair uses its nearest periodic image plus the table's correction.
+void accumulatePairsSymmetric(const std::vector<CelestialBody>& bodies, size_t first, size_t step, float G, float softening,
+                              glm::vec2* acc, std::vector<std::pair<int, int>>& overlaps, const EwaldTable* ewald = nullptr) {
+
+    const size_t count = bodies.size();
+
+    for (size_t i = first; i < count; i += step) {
+        const CelestialBody& a = bodies[i];
+        if (!a.exists) continue; // merged away earlier this frame, gone from gravity and collisions
+        glm::vec2 accI(0.0f);
+
+        for (size_t j = i + 1; j < count; ++j) {
+            const CelestialBody& b = bodies[j];
+
+            if (!b.exists) continue;
+            if (a.isDebris && b.isDebris) continue; // don't let debris interact with other debris (for performance).
+
+            glm::vec2 direction = b.position - a.position;
+            if (ewald) direction = ewald->nearestImage(direction);
+            float distanceSq = glm::dot(direction, direction); // r^2
+
+            float radiusSum = a.radius + b.radius;
+            if (distanceSq < radiusSum * radiusSum) {
+                overlaps.push_back(std::make_pair((int)i, (int)j));
+            }
+
+            if (distanceSq <= 0.0f) continue;
+
+            // G / ((r^2 + softening) * r): one sqrt and one divide, no normalize
+            float scale = G / ((distanceSq + softening) * std::sqrt(distanceSq));
+            glm::vec2 pull = direction * scale;
+            if (ewald) pull -= ewald->correction(direction) * G; // correction is odd, so this works for both ends
+
+            accI += pull * b.mass;
+            acc[j] -= pull * a.mass;
+        }
+
+        acc[i] += accI;
+    }
+}
+
+
+void computeDirectSymmetric(const std::vector<CelestialBody>& bodies, float G, float softening,
+                            std::vector<glm::vec2>& acc, std::vector<std::pair<int, int>>& overlaps, const EwaldTable* ewald = nullptr) {
+
+    acc.assign(bodies.size(), glm::vec2(0.0f));
+    overlaps.clear();
+
+    accumulatePairsSymmetric(bodies, 0, 1, G, softening, acc.data(), overlaps, ewald);
+}
+
+
+// What the pair loop reads of a body. CelestialBody carries its 256 byte ID along, so a
+// tile of them wouldn't stay in cache; packed, a tile of 256 is 5 KB.
+struct PackedBody {
+    glm::vec2 position;
+    float mass;
+    float radius;
+    bool exists;
+    bool isDebris;
+};
+
+const size_t DIRECT_TILE_BODIES = 256;
+
+// Every pair between bodies [iBegin, iEnd) and [jBegin, jEnd), both ways, same kernel as
+// accumulatePairsSymmetric. The i range comes first in the list; the same range twice is
+// the triangle of a tile with itself.
+void accumulateTilePair(const std::vector<PackedBody>& packed, size_t iBegin, size_t iEnd, size_t jBegin, size_t jEnd, float G, float softening,
+                        glm::vec2* acc, std::vector<std::pair<int, int>>& overlaps, const EwaldTable* ewald) {
+
+    const bool sameTile = iBegin == jBegin;
+
+    for (size_t i = iBegin; i < iEnd; ++i) {
+        const PackedBody& a = packed[i];
+        if (!a.exists) continue;
+        glm::vec2 accI(0.0f);
+
+        for (size_t j = sameTile ? i + 1 : jBegin; j < jEnd; ++j) {
+            const PackedBody& b = packed[j];
+
+            if (!b.exists) continue;
+            if (a.isDebris && b.isDebris) continue;
+
+            glm::vec2 direction = b.position - a.position;
+            if (ewald) direction = ewald->nearestImage(direction);
+            float distanceSq = glm::dot(direction, direction);
+
+            float radiusSum = a.radius + b.radius;
+            if (distanceSq < radiusSum * radiusSum) {
+                overlaps.push_back(std::make_pair((int)i, (int)j));
+            }
+
+            if (distanceSq <= 0.0f) continue;
+
+            float scale = G / ((distanceSq + softening) * std::sqrt(distanceSq));
+            glm::vec2 pull = direction * scale;
+            if (ewald) pull -= ewald->correction(direction) * G;
+
+            accI += pull * b.mass;
+            acc[j] -= pull * a.mass;
+        }
+
+        acc[i] += accI;
+    }
+}
+
+
+// Same kernel split over the pool, in tiles. The bodies are cut into tiles of
+// DIRECT_TILE_BODIES (i blocks and j tiles are the same cut), and each tile with itself or
+// with another tile is one task. The tasks run in rounds of a round robin where no tile
+// shows up twice, so a task writes both tiles' accelerations straight into acc, no
+// per-thread buffers or reduction, and every body gets its pulls in the same order
+// whatever the thread count. One thread, 50k bodies: 7.6 s, against 19.6 s when each task
+// ran whole rows over the bodies themselves (and 20.1 s for the plain loop).
+void computeDirectSymmetricThreaded(const std::vector<CelestialBody>& bodies, float G, float softening, ThreadPool& pool,
+                                    std::vector<glm::vec2>& acc, std::vector<std::pair<int, int>>& overlaps, const EwaldTable* ewald = nullptr) {
+
+    const size_t count = bodies.size();
+
+    // Small scenes aren't worth splitting (this doesn't depend on the thread count)
+    if (count < 1024) {
+        computeDirectSymmetric(bodies, G, softening, acc, overlaps, ewald);
+        return;
+    }
+
+    static std::vector<PackedBody> packed;
+    packed.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const CelestialBody& body = bodies[i];
+        packed[i] = { body.position, body.mass, body.radius, body.exists, body.isDebris };
+    }
+
+    // Round robin (circle method) over an even number of tiles, the spare one is a bye
+    const int tiles = (int)((count + DIRECT_TILE_BODIES - 1) / DIRECT_TILE_BODIES);
+    const int slots = (tiles + 1) / 2;
+    const int seats = 2 * slots;
+
+    static std::vector<std::vector<std::pair<int, int>>> slotOverlaps;
+    slotOverlaps.resize(std::max(slots, tiles));
+    for (auto& list : slotOverlaps) list.clear();
+
+    acc.assign(count, glm::vec2(0.0f));
+
+    auto runTiles = [&](int a, int b, int slot) {
+        if (a >= tiles || b >= tiles) return;
+        if (a > b) std::swap(a, b);
+        accumulateTilePair(packed, a * DIRECT_TILE_BODIES, std::min(count, (a + 1) * DIRECT_TILE_BODIES),
+                           b * DIRECT_TILE_BODIES, std::min(count, (b + 1) * DIRECT_TILE_BODIES), G, softening, acc.data(), slotOverlaps[slot], ewald);
+    };
+
+    // Each tile with itself
+    pool.parallelFor(tiles, [&](int t) {
+        runTiles(t, t, t);
+    });
+
+    // Then seats - 1 rounds of tile pairs: the last seat stays, the others turn
+    for (int round = 0; round < seats - 1; ++round) {
+        pool.parallelFor(slots, [&](int k) {
+            int a = k == 0 ? seats - 1 : (round + k) % (seats - 1);
+            int b = (round - k + seats - 1) % (seats - 1);
+            runTiles(a, b, k);
+        });
+    }
+
+    // Same pair order as the single threaded loop
+    overlaps.clear();
+    for (const auto& list : slotOverlaps) {
+        overlaps.insert(overlaps.end(), list.begin(), list.end());
+    }
+    std::sort(overlaps.begin(), overlaps.end());
+}
+
+
+// Only the listed bodies (the active rung of a block step) against everyone, so each pair
+// is visited from the listed end and Newton's third law can't be used. Overlaps come out
+// as (smaller, bigger), sorted and without repeats.
+void computeDirectRows(const std::vector<CelestialBody>& bodies, const std::vector<int>& rows, float G, float softening, ThreadPool& pool,
+                       std::vector<glm::vec2>& acc, std::vector<std::pair<int, int>>& overlaps, const EwaldTable* ewald = nullptr) {
+
+    const size_t count = bodies.size();
+    const int block = 64;
+    const int taskCount = (int)((rows.size() + block - 1) / block);
+
+    acc.assign(count, glm::vec2(0.0f));
+
+    static std::vector<std::vector<std::pair<int, int>>> taskOverlaps;
+    taskOverlaps.resize(taskCount);
+
+    pool.parallelFor(taskCount, [&](int t) {
+        taskOverlaps[t].clear();
+        size_t end = std::min(rows.size(), (size_t)(t + 1) * block);
+
+        for (size_t r = (size_t)t * block; r < end; ++r) {
+            const int i = rows[r];
+            const CelestialBody& a = bodies[i];
+            if (!a.exists) continue;
+            glm::vec2 accI(0.0f);
+
+            for (size_t j = 0; j < count; ++j) {
+                const CelestialBody& b = bodies[j];
+                if ((int)j == i || !b.exists) continue;
+                if (a.isDebris && b.isDebris) continue;
+
+                glm::vec2 direction = b.position - a.position;
+                if (ewald) direction = ewald->nearestImage(direction);
+                float distanceSq = glm::dot(direction, direction);
+
+                float radiusSum = a.radius + b.radius;
+                if (distanceSq < radiusSum * radiusSum) {
+                    taskOverlaps[t].push_back(std::make_pair(std::min(i, (int)j), std::max(i, (int)j)));
+                }
+
+                if (distanceSq <= 0.0f) continue;
+
+                float scale = G / ((distanceSq + softening) * std::sqrt(distanceSq));
+                glm::vec2 pull = direction * scale;
+                if (ewald) pull -= ewald->correction(direction) * G;
+
+                accI += pull * b.mass;
+            }
+
+            acc[i] = accI;
+        }
+    });
+
+    overlaps.clear();
+    for (int t = 0; t < taskCount; ++t) {
+        overlaps.insert(overlaps.end(), taskOverlaps[t].begin(), taskOverlaps[t].end());
+    }
+    std::sort(overlaps.begin(), overlaps.end());
+    overlaps.erase(std::unique(overlaps.begin(), overlaps.end()), overlaps.end());
+}
+
+
+// Acceleration and its time derivative (the jerk) for the listed bodies against everyone,
+// for the Hermite integrator. With d = xj - xi, u = vj - vi and our softened pull
+// d * g(r), g = 1 / ((r^2 + softening) r), the jerk of a pair is
+//     G m [ u g - d (d.u) g (3 r^2 + softening) / ((r^2 + softening) r^2) ]
+// which is just the derivative of the pull along the relative motion. In the periodic box
+// the Ewald correction goes into the acceleration only, it is small and smooth enough
+// that leaving it out of the jerk costs little. Overlaps come out like computeDirectRows.
+void computeDirectJerkRows(const std::vector<CelestialBody>& bodies, const std::vector<int>& rows, float G, float softening, ThreadPool& pool,
+                           std::vector<glm::vec2>& acc, std::vector<glm::vec2>& jerk, std::vector<std::pair<int, int>>& overlaps,
+                           const EwaldTable* ewald = nullptr) {
+
+    const size_t count = bodies.size();
+    const int block = 64;
+    const int taskCount = (int)((rows.size() + block - 1) / block);
+
+    acc.resize(count);
+    jerk.resize(count);
+
+    static std::vector<std::vector<std::pair<int, int>>> taskOverlaps;
+    taskOverlaps.resize(taskCount);
+
+    pool.parallelFor(taskCount, [&](int t) {
+        taskOverlaps[t].clear();
+        size_t end = std::min(rows.size(), (size_t)(t + 1) * block);
+
+        for (size_t r = (size_t)t * block; r < end; ++r) {
+            const int i = rows[r];
+            const CelestialBody& a = bodies[i];
+            glm::vec2 accI(0.0f);
+            glm::vec2 jerkI(0.0f);
+
+            for (size_t j = 0; j < count && a.exists; ++j) {
+                const CelestialBody& b = bodies[j];
+                if ((int)j == i || !b.exists) continue;
+                if (a.isDebris && b.isDebris) continue;
+
+                glm::vec2 direction = b.position - a.position;
+                if (ewald) direction = ewald->nearestImage(direction);
+                float distanceSq = glm::dot(direction, direction);
+
+                float radiusSum = a.radius + b.radius;
+                if (distanceSq < radiusSum * radiusSum) {
+                    taskOverlaps[t].push_back(std::make_pair(std::min(i, (int)j), std::max(i, (int)j)));
+                }
+
+                if (distanceSq <= 0.0f) continue;
+
+                glm::vec2 relativeVelocity = b.velocity - a.velocity;
+                float soft = distanceSq + softening;
+                float g = G * b.mass / (soft * std::sqrt(distanceSq));
+                float rate = glm::dot(direction, relativeVelocity) * (3.0f * distanceSq + softening) / (soft * distanceSq);
+
+                accI += direction * g;
+                if (ewald) accI -= ewald->correction(direction) * (G * b.mass);
+                jerkI += (relativeVelocity - direction * rate) * g;
+            }
+
+            acc[i] = accI;
+            jerk[i] = jerkI;
+        }
+    });
+
+    overlaps.clear();
+    for (int t = 0; t < taskCount; ++t) {
+        overlaps.insert(overlaps.end(), taskOverlaps[t].begin(), taskOverlaps[t].end());
+    }
+    std::sort(overlaps.begin(), overlaps.end());
+    overlaps.erase(std::unique(overlaps.begin(), overlaps.end()), overlaps.end());
+}
+
+
+// Pull between the listed bodies only, in double, at positions given separately (the
+// Gauss-Radau integrator keeps its own double copy, and tries positions it doesn't keep).
+// positions[k] and acc[k] belong to bodies[members[k]]. This one does rows first to end.
+void accumulateDoubleRows(const std::vector<CelestialBody>& bodies, const std::vector<int>& members, const std::vector<glm::dvec2>& positions,
+                          double G, double softening, size_t first, size_t end, std::vector<glm::dvec2>& acc) {
+
+    const size_t count = members.size();
+    for (size_t k = first; k < end; ++k) {
+        const CelestialBody& a = bodies[members[k]];
+        glm::dvec2 accK(0.0);
+
+        for (size_t j = 0; j < count; ++j) {
+            const CelestialBody& b = bodies[members[j]];
+            if (j == k || !b.exists) continue;
+            if (a.isDebris && b.isDebris) continue;
+
+            glm::dvec2 direction = positions[j] - positions[k];
+            double distanceSq = glm::dot(direction, direction);
+            if (distanceSq <= 0.0) continue;
+
+            accK += direction * (b.mass / ((distanceSq + softening) * std::sqrt(distanceSq)));
+        }
+
+        acc[k] = accK * G;
+    }
+}
+
+// Same over the pool, in fixed blocks of rows
+void computeDirectDouble(const std::vector<CelestialBody>& bodies, const std::vector<int>& members, const std::vector<glm::dvec2>& positions,
+                         double G, double softening, ThreadPool& pool, std::vector<glm::dvec2>& acc) {
+
+    const size_t count = members.size();
+    const int block = 64;
+    const int taskCount = (int)((count + block - 1) / block);
+
+    acc.resize(count);
+
+    pool.parallelFor(taskCount, [&](int t) {
+        accumulateDoubleRows(bodies, members, positions, G, softening, (size_t)t * block, std::min(count, (size_t)(t + 1) * block), acc);
+    });
+}
+
+#endif
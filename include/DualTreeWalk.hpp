@@ -0,0 +1,485 @@
+#ifndef DUAL_TREE_WALK_H
+#define DUAL_TREE_WALK_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "ThreadPool.hpp"
+#include "BarnesHut.hpp"
+
+
+// Dual tree walk (Dehnen 2000, 2002): the tree is walked against itself, cell against cell,
+// and every interaction counts both ways. When two cells A and B are far enough apart,
+//     reach A + reach B < theta * |comA - comB|     (reach: farthest body from the center of mass)
+// B's multipoles are turned into a local expansion of the potential around A's center of mass,
+// and A's around B's, from the same derivatives of the kernel. Cells too close are split, the
+// bigger one first, down to leaves that are summed body by body (also both ways). Then the
+// local expansions are handed down the tree and evaluated at the bodies. Every pass is O(N).
+//
+// The kernel is the softened potential itself, phi'(r) = 1 / (r^2 + softening), so the field
+// is the same law as everywhere else. Its derivatives come from D_m = (1/r d/dr)^m phi, which
+// is a short closed form in r^2. The sources are the tree's multipoles (TreeMultipole: 0, 2 or
+// 3) and the terms kept are those with source order + local order <= 4 (2 for monopoles only).
+// Going past the source order matters: the error of a pair is ((reach A + reach B) / R)^p,
+// and most of it is on the local side, since bodies sit anywhere in A and not at its center
+// of mass. At 100k on the disk below, quadrupoles at theta 0.5 give 2.0e-2 with the local
+// stopped at order 3 and 3.9e-3 at order 4, for about 20% more time.
+//
+// Both cells of an interaction get written, so the walk can't simply be split by target. The
+// top levels are planned into phases of tasks that touch separate subtrees (a cell with
+// itself, or two cells that don't overlap), and each phase runs on the pool. The plan only
+// depends on the tree, so the result doesn't depend on the thread count.
+//
+// Mean relative error and time against a direct sum, one thread, quadrupoles, softening 0.01,
+// built without -march (so the grouped walk is scalar). Disk: uniform, radius 10. Clumps: 20
+// clumps with most bodies in the middle; at 1M their cores end up in leaves of up to 3000
+// bodies at the tree's depth limit, and those direct sums are most of the time for every walk.
+//                    theta   per body          grouped           dual
+//     10k disk        0.5    1.5e-3    45 ms   9.7e-4    22 ms   5.7e-3    17 ms
+//                     0.7    6.8e-3    22 ms   4.8e-3    11 ms   2.3e-2    11 ms
+//     100k disk       0.5    1.8e-3   770 ms   1.3e-3   281 ms   3.9e-3   204 ms
+//                     0.7    8.3e-3   494 ms   5.7e-3   167 ms   1.3e-2   135 ms
+//     1M disk         0.5    1.4e-3  25.5 s    1.1e-3   4.8 s    2.2e-3   2.8 s
+//                     0.7    7.9e-3  11.8 s    6.6e-3   1.9 s    9.7e-3   1.4 s
+//     10k clumps      0.5    2.8e-4    36 ms   2.3e-4    18 ms   2.6e-3    15 ms
+//                     0.7    1.0e-3    27 ms   1.2e-3    14 ms   3.6e-3    11 ms
+//     100k clumps     0.5    3.2e-4  1501 ms   2.8e-4   359 ms   4.0e-4   184 ms
+//                     0.7    7.8e-4   681 ms   6.7e-4   213 ms   1.2e-3   139 ms
+//     1M clumps       0.5    2.0e-3  46.8 s    2.9e-3   7.5 s    2.3e-3   5.7 s
+//                     0.7    3.2e-3  33.7 s    4.7e-3   4.3 s    3.6e-3   4.2 s
+// The same theta is looser here than for the other walks, since it bounds both cells and not
+// just the source: the dual walk at 0.5 is about as accurate as the per body walk at 0.7.
+// Going 10x in bodies on the disk, the dual walk takes 12-14x longer, the grouped walk 13-17x.
+// At matching error the dual and grouped walks cost about the same up to 1M (grouped measured
+// with its lists rebuilt every call).
+class DualTreeWalk {
+public:
+    int planDepth = 4;              // tree levels split into parallel tasks at the top of the walk
+
+    void computeAccelerations(const QuadTree& tree, const std::vector<CelestialBody>& bodies, float G, float theta, float softening,
+                              ThreadPool& pool, std::vector<glm::vec2>& acc) {
+        acc.assign(bodies.size(), glm::vec2(0.0f));
+        if (tree.nodes.empty() || tree.nodes[0].count == 0) return;
+
+        this->tree = &tree;
+        this->bodies = &bodies;
+        this->acc = &acc;
+        this->G = G;
+        this->softening = softening;
+        thetaSq = theta * theta;
+        sourceOrder = std::min(tree.multipoleOrder, 3);
+        order = sourceOrder == 0 ? 2 : MAX_ORDER;
+
+        const std::vector<QuadNode>& nodes = tree.nodes;
+        const int nodeCount = (int)nodes.size();
+        locals.assign((size_t)nodeCount * LOCAL_SIZE, 0.0);
+        findReach(pool);
+
+        // The interactions, phase by phase
+        phases.clear();
+        planSelf(0, planDepth, 0);
+        for (const std::vector<Task>& phase : phases) {
+            pool.parallelFor((int)phase.size(), [&](int t) {
+                const Task& task = phase[t];
+                if (task.a == task.b) interactSelf(task.a);
+                else interactPair(task.a, task.b);
+            });
+        }
+
+        // Down the tree: the top part here, then subtrees in parallel
+        const int targetBodies = std::max(tree.leafCapacity, nodes[0].count / 256);
+        targets.clear();
+        collectTargets(0, targetBodies);
+        pool.parallelFor((int)targets.size(), [&](int t) {
+            pushDown(targets[t]);
+        });
+    }
+
+private:
+    // Local coefficients C^(k) for k = 1..4, each a symmetric rank k tensor stored by how many
+    // of its indices are y (k + 1 numbers), so 2 + 3 + 4 + 5 per node
+    static const int MAX_ORDER = 4;
+    static const int LOCAL_SIZE = 14;
+
+    struct Task {
+        int a;
+        int b;      // b == a: the cell with itself
+    };
+
+    const QuadTree* tree = nullptr;
+    const std::vector<CelestialBody>* bodies = nullptr;
+    std::vector<glm::vec2>* acc = nullptr;
+    float G = 1.0f;
+    float softening = 0.0f;
+    float thetaSq = 0.0f;
+    int sourceOrder = 2;
+    int order = 3;
+
+    std::vector<double> locals;         // LOCAL_SIZE per node
+    std::vector<float> reach;           // farthest body from each node's center of mass
+    std::vector<std::vector<Task>> phases;
+    std::vector<int> targets;
+
+    static int offset(int rank) { return (rank - 1) * (rank + 2) / 2; }
+
+    static double binomial(int n, int k) {
+        static const double table[4][4] = { { 1, 0, 0, 0 }, { 1, 1, 0, 0 }, { 1, 2, 1, 0 }, { 1, 3, 3, 1 } };
+        return table[n][k];
+    }
+
+    static double factorial(int n) {
+        static const double table[5] = { 1, 1, 2, 6, 24 };
+        return table[n];
+    }
+
+    // The moments of order 0, 2 and 3 about the center of mass, component i (i of the n indices
+    // are y) times binomial(n, i) / n!, so a contraction with D is a plain sum
+    static const int MOMENT_SIZE = 8;
+
+    static int momentOffset(int n) { return n == 0 ? 0 : n == 2 ? 1 : 4; }
+
+    static void weightedMoments(const QuadNode& node, double* M) {
+        M[0] = node.mass;
+        M[1] = node.quadrupole[0] * 0.5;
+        M[2] = node.quadrupole[1];
+        M[3] = node.quadrupole[2] * 0.5;
+        M[4] = node.octupole[0] / 6.0;
+        M[5] = node.octupole[1] * 0.5;
+        M[6] = node.octupole[2] * 0.5;
+        M[7] = node.octupole[3] / 6.0;
+    }
+
+    // Leaves from their bodies, in parallel, then the rest bottom up (children always come after
+    // their parent in the node list). Bounded by the farthest corner of the cell too.
+    void findReach(ThreadPool& pool) {
+        const std::vector<QuadNode>& nodes = tree->nodes;
+        const int nodeCount = (int)nodes.size();
+        reach.assign(nodeCount, 0.0f);
+
+        const int block = 1024;
+        pool.parallelFor((nodeCount + block - 1) / block, [&](int t) {
+            int end = std::min(nodeCount, (t + 1) * block);
+            for (int n = t * block; n < end; ++n) {
+                const QuadNode& node = nodes[n];
+                if (node.firstChild >= 0) continue;
+                float farthest = 0.0f;
+                for (int k = node.start; k < node.start + node.count; ++k) {
+                    glm::vec2 d = (*bodies)[tree->bodyIndex[k]].position - node.centerOfMass;
+                    farthest = std::max(farthest, glm::dot(d, d));
+                }
+                reach[n] = std::sqrt(farthest);
+            }
+        });
+
+        for (int n = nodeCount - 1; n >= 0; --n) {
+            const QuadNode& node = nodes[n];
+            if (node.firstChild < 0 || node.count == 0) continue;
+
+            float farthest = 0.0f;
+            for (int q = 0; q < 4; ++q) {
+                const QuadNode& child = nodes[node.firstChild + q];
+                if (child.count == 0) continue;
+                farthest = std::max(farthest, glm::length(child.centerOfMass - node.centerOfMass) + reach[node.firstChild + q]);
+            }
+            glm::vec2 corner = glm::abs(node.centerOfMass - node.center) + node.halfSize;
+            reach[n] = std::min(farthest, glm::length(corner));
+        }
+    }
+
+    bool separated(int a, int b) const {
+        const QuadNode& A = tree->nodes[a];
+        const QuadNode& B = tree->nodes[b];
+        glm::vec2 R = A.centerOfMass - B.centerOfMass;
+        float size = reach[a] + reach[b];
+        return size * size < thetaSq * glm::dot(R, R);
+    }
+
+    void addTask(int phase, int a, int b) {
+        if ((int)phases.size() <= phase) phases.resize(phase + 1);
+        phases[phase].push_back({ a, b });
+    }
+
+    // Plans a cell with itself from phase start on, returns the phase after its last one.
+    // The children each with themselves all at once, then the 6 pairs of children in 3 rounds
+    // of 2 that don't share a child.
+    int planSelf(int a, int depth, int start) {
+        const QuadNode& node = tree->nodes[a];
+        if (node.count == 0) return start;
+        if (depth == 0 || node.firstChild < 0) {
+            addTask(start, a, a);
+            return start + 1;
+        }
+
+        int end = start;
+        for (int q = 0; q < 4; ++q) {
+            end = std::max(end, planSelf(node.firstChild + q, depth - 1, start));
+        }
+
+        static const int rounds[3][2][2] = { { { 0, 1 }, { 2, 3 } }, { { 0, 2 }, { 1, 3 } }, { { 0, 3 }, { 1, 2 } } };
+        for (int r = 0; r < 3; ++r) {
+            int next = end;
+            for (int k = 0; k < 2; ++k) {
+                next = std::max(next, planPair(node.firstChild + rounds[r][k][0], node.firstChild + rounds[r][k][1], depth - 1, end));
+            }
+            end = next;
+        }
+        return end;
+    }
+
+    // Two separate cells: split both, and run the pairs of children in rounds where no child
+    // shows up twice
+    int planPair(int a, int b, int depth, int start) {
+        const QuadNode& A = tree->nodes[a];
+        const QuadNode& B = tree->nodes[b];
+        if (A.count == 0 || B.count == 0) return start;
+        if (depth == 0 || separated(a, b) || (A.firstChild < 0 && B.firstChild < 0)) {
+            addTask(start, a, b);
+            return start + 1;
+        }
+
+        int as[4], bs[4];
+        int aCount = 0, bCount = 0;
+        if (A.firstChild < 0) as[aCount++] = a;
+        else for (int q = 0; q < 4; ++q) as[aCount++] = A.firstChild + q;
+        if (B.firstChild < 0) bs[bCount++] = b;
+        else for (int q = 0; q < 4; ++q) bs[bCount++] = B.firstChild + q;
+
+        const int n = std::max(aCount, bCount);
+        int end = start;
+        for (int r = 0; r < n; ++r) {
+            int next = end;
+            for (int i = 0; i < aCount; ++i) {
+                int j = (i + r) % n;
+                if (j < bCount) next = std::max(next, planPair(as[i], bs[j], depth - 1, end));
+            }
+            end = next;
+        }
+        return end;
+    }
+
+    void interactSelf(int a) {
+        const QuadNode& node = tree->nodes[a];
+        if (node.count == 0) return;
+
+        if (node.firstChild < 0) {
+            for (int i = node.start; i < node.start + node.count; ++i) {
+                for (int k = i + 1; k < node.start + node.count; ++k) {
+                    bodyPair(tree->bodyIndex[i], tree->bodyIndex[k]);
+                }
+            }
+            return;
+        }
+
+        for (int p = 0; p < 4; ++p) {
+            interactSelf(node.firstChild + p);
+            for (int q = p + 1; q < 4; ++q) {
+                interactPair(node.firstChild + p, node.firstChild + q);
+            }
+        }
+    }
+
+    void interactPair(int a, int b) {
+        const QuadNode& A = tree->nodes[a];
+        const QuadNode& B = tree->nodes[b];
+        if (A.count == 0 || B.count == 0) return;
+
+        if (separated(a, b)) {
+            cellPair(a, b);
+            return;
+        }
+
+        const bool aLeaf = A.firstChild < 0;
+        const bool bLeaf = B.firstChild < 0;
+        if (aLeaf && bLeaf) {
+            for (int i = A.start; i < A.start + A.count; ++i) {
+                for (int k = B.start; k < B.start + B.count; ++k) {
+                    bodyPair(tree->bodyIndex[i], tree->bodyIndex[k]);
+                }
+            }
+            return;
+        }
+
+        if (bLeaf || (!aLeaf && reach[a] >= reach[b])) {
+            for (int q = 0; q < 4; ++q) interactPair(A.firstChild + q, b);
+        }
+        else {
+            for (int q = 0; q < 4; ++q) interactPair(a, B.firstChild + q);
+        }
+    }
+
+    void bodyPair(int i, int j) {
+        const CelestialBody& a = (*bodies)[i];
+        const CelestialBody& b = (*bodies)[j];
+        glm::vec2 direction = b.position - a.position;
+        float distanceSq = glm::dot(direction, direction);
+        if (distanceSq <= 0.0f) return;
+
+        glm::vec2 pull = direction * (G / ((distanceSq + softening) * std::sqrt(distanceSq)));
+        (*acc)[i] += pull * b.mass;
+        (*acc)[j] -= pull * a.mass;
+    }
+
+    // Both local expansions from one set of derivatives at R = comA - comB:
+    //     C_A^(k) += sum_n (-1)^n / n! M_B^(n) . D^(n+k)(R)
+    //     C_B^(k) += (-1)^k sum_n 1 / n! M_A^(n) . D^(n+k)(R)       (D^(q)(-R) = (-1)^q D^(q)(R))
+    void cellPair(int a, int b) {
+        double D[LOCAL_SIZE];
+        derivatives(glm::dvec2(tree->nodes[a].centerOfMass) - glm::dvec2(tree->nodes[b].centerOfMass), D);
+
+        double MA[MOMENT_SIZE], MB[MOMENT_SIZE];
+        weightedMoments(tree->nodes[a], MA);
+        weightedMoments(tree->nodes[b], MB);
+
+        double* CA = &locals[(size_t)a * LOCAL_SIZE];
+        double* CB = &locals[(size_t)b * LOCAL_SIZE];
+        for (int k = 1; k <= order; ++k) {
+            const double sign = (k & 1) ? -1.0 : 1.0;
+            for (int n = 0; n <= sourceOrder && n + k <= order; ++n) {
+                if (n == 1) continue;
+                const double* Dn = &D[offset(n + k)];
+                const double* mA = &MA[momentOffset(n)];
+                const double* mB = &MB[momentOffset(n)];
+                const double nSign = (n & 1) ? -1.0 : 1.0;
+
+                for (int t = 0; t <= k; ++t) {
+                    double fromB = 0.0, fromA = 0.0;
+                    for (int i = 0; i <= n; ++i) {
+                        fromB += mB[i] * Dn[i + t];
+                        fromA += mA[i] * Dn[i + t];
+                    }
+                    CA[offset(k) + t] += nSign * fromB;
+                    CB[offset(k) + t] += sign * fromA;
+                }
+            }
+        }
+    }
+
+    // Derivative tensors D^(q) of phi at R for q = 1..order. With D_m = (1/r d/dr)^m phi,
+    // each component is
+    //     d^a/dx^a d^b/dy^b phi = sum_i,j c(a,i) c(b,j) x^(a-2i) y^(b-2j) D_(a+b-i-j),   c(a,i) = a! / (2^i i! (a-2i)!)
+    // and D_m = 2^(m-1) d^(m-1)/du^(m-1) [u^(-1/2) (u + softening)^(-1)] at u = r^2.
+    void derivatives(glm::dvec2 R, double* D) const {
+        const double u = glm::dot(R, R);
+        const double eps = softening;
+
+        // Derivatives of u^(-1/2) and of (u + eps)^(-1)
+        double powerTerms[MAX_ORDER], poleTerms[MAX_ORDER];
+        double root = 1.0 / std::sqrt(u), pole = 1.0 / (u + eps);
+        powerTerms[0] = root;
+        poleTerms[0] = pole;
+        for (int j = 1; j < order; ++j) {
+            powerTerms[j] = powerTerms[j - 1] * (-0.5 - (j - 1)) / u;
+            poleTerms[j] = poleTerms[j - 1] * -(double)j * pole;
+        }
+
+        double radial[MAX_ORDER + 1];
+        for (int m = 1; m <= order; ++m) {
+            double sum = 0.0;
+            for (int j = 0; j < m; ++j) {
+                sum += binomial(m - 1, j) * powerTerms[j] * poleTerms[m - 1 - j];
+            }
+            radial[m] = std::ldexp(sum, m - 1);
+        }
+
+        double xPow[MAX_ORDER + 1], yPow[MAX_ORDER + 1];
+        xPow[0] = yPow[0] = 1.0;
+        for (int n = 1; n <= order; ++n) {
+            xPow[n] = xPow[n - 1] * R.x;
+            yPow[n] = yPow[n - 1] * R.y;
+        }
+
+        // c(a, i) for a up to 4
+        static const double c[5][3] = { { 1, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 3, 0 }, { 1, 6, 3 } };
+        for (int q = 1; q <= order; ++q) {
+            for (int b = 0; b <= q; ++b) {
+                const int a = q - b;
+                double sum = 0.0;
+                for (int i = 0; 2 * i <= a; ++i) {
+                    for (int j = 0; 2 * j <= b; ++j) {
+                        sum += c[a][i] * c[b][j] * xPow[a - 2 * i] * yPow[b - 2 * j] * radial[q - i - j];
+                    }
+                }
+                D[offset(q) + b] = sum;
+            }
+        }
+    }
+
+    // Contraction of C^(rank) with y taken `times` times, component t of what's left
+    static double contract(const double* C, int rank, int times, int t, glm::dvec2 y) {
+        double sum = 0.0;
+        double yPow = 1.0;
+        for (int i = 0; i <= times; ++i) {
+            sum += binomial(times, i) * C[offset(rank) + t + i] * std::pow(y.x, times - i) * yPow;
+            yPow *= y.y;
+        }
+        return sum;
+    }
+
+    // Re-centers a node's expansion on its child: C'^(k) += sum_j>=k 1/(j-k)! C^(j) . y^(j-k)
+    void shiftDown(int parent, int child) {
+        const std::vector<QuadNode>& nodes = tree->nodes;
+        const glm::dvec2 y = glm::dvec2(nodes[child].centerOfMass) - glm::dvec2(nodes[parent].centerOfMass);
+        const double* C = &locals[(size_t)parent * LOCAL_SIZE];
+        double* out = &locals[(size_t)child * LOCAL_SIZE];
+
+        for (int k = 1; k <= order; ++k) {
+            for (int t = 0; t <= k; ++t) {
+                double sum = 0.0;
+                for (int j = k; j <= order; ++j) {
+                    sum += contract(C, j, j - k, t, y) / factorial(j - k);
+                }
+                out[offset(k) + t] += sum;
+            }
+        }
+    }
+
+    // Down to the subtrees that run on their own, shifting as we go
+    void collectTargets(int a, int targetBodies) {
+        const QuadNode& node = tree->nodes[a];
+        if (node.firstChild < 0 || node.count <= targetBodies) {
+            targets.push_back(a);
+            return;
+        }
+        for (int q = 0; q < 4; ++q) {
+            int child = node.firstChild + q;
+            if (tree->nodes[child].count == 0) continue;
+            shiftDown(a, child);
+            collectTargets(child, targetBodies);
+        }
+    }
+
+    // The rest of the way to the bodies: a = -G sum_k 1/(k-1)! C^(k) . y^(k-1)
+    void pushDown(int a) {
+        const QuadNode& node = tree->nodes[a];
+
+        if (node.firstChild < 0) {
+            const double* C = &locals[(size_t)a * LOCAL_SIZE];
+            for (int k = node.start; k < node.start + node.count; ++k) {
+                int i = tree->bodyIndex[k];
+                glm::dvec2 y = glm::dvec2((*bodies)[i].position) - glm::dvec2(node.centerOfMass);
+                glm::dvec2 field(0.0);
+                for (int rank = 1; rank <= order; ++rank) {
+                    double weight = 1.0 / factorial(rank - 1);
+                    field.x += weight * contract(C, rank, rank - 1, 0, y);
+                    field.y += weight * contract(C, rank, rank - 1, 1, y);
+                }
+                (*acc)[i] -= glm::vec2(field * (double)G);
+            }
+            return;
+        }
+
+        for (int q = 0; q < 4; ++q) {
+            int child = node.firstChild + q;
+            if (tree->nodes[child].count == 0) continue;
+            shiftDown(a, child);
+            pushDown(child);
+        }
+    }
+};
+
+
+#endif
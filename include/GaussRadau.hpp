@@ -0,0 +1,286 @@
+#ifndef GAUSS_RADAU_H
+#define GAUSS_RADAU_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+
+// 15th order Gauss-Radau integrator with its own step size control, IAS15 (Rein & Spiegel
+// 2015, after Everhart 1985). Over a step the acceleration is taken as a polynomial in the
+// step fraction s,
+//     a(s) = a0 + b0 s + b1 s^2 + ... + b6 s^7
+// and the b are found by evaluating the forces at the 7 Gauss-Radau spacings inside the
+// step, over and over (predictor-corrector) until they stop changing. Integrated twice
+// that gives the new position and velocity, good to 15th order in the step.
+//
+// The last coefficient b6 is about the error of the step, so the next step is
+//     dt' = dt (accuracy / (max |b6| / max |a|))^(1/7)
+// and a step that comes out more than 4x too long is done again. Quiet stretches go by
+// in a few long steps, a close pass gets as many short ones as it needs.
+//
+// Everything is in double, and the sums into position and velocity are compensated, so
+// the step error sits below round-off. The b of a step are extrapolated to the next one
+// as a start, then it usually takes 2 iterations.
+class GaussRadau {
+public:
+    double accuracy = 1e-9;     // allowed max |b6| / max |a|
+
+    // Start over, the bodies or their order changed
+    void reset() {
+        count = 0;
+        nextStep = 0.0;
+    }
+
+    // Moves positions and velocities on by span (negative goes back), in as many steps as it
+    // takes. pull(x, a) has to fill a with the accelerations at positions x.
+    // Returns the number of steps taken.
+    template <typename Pull>
+    int integrate(std::vector<glm::dvec2>& positions, std::vector<glm::dvec2>& velocities, double span, Pull pull) {
+        setup();
+        if (positions.size() != count) {
+            resize(positions.size());
+        }
+        if (count == 0 || span == 0.0) return 0;
+
+        double dt = std::abs(nextStep) > 0.0 ? std::copysign(std::abs(nextStep), span) : span;
+        if (std::abs(dt) > std::abs(span)) dt = span;
+
+        // Steps don't get shorter than this. Our softened pull has a kink where two bodies sit
+        // on top of each other (it points at the other one with the same strength from any
+        // side), and bodies caught there would take ever shorter steps without getting anywhere.
+        const double smallest = std::abs(span) * 1e-4;
+
+        double done = 0.0;
+        int steps = 0;
+        bool finished = false;
+        pull(positions, a0);
+
+        while (!finished) {
+            const double remaining = span - done;
+            const bool clipped = std::abs(dt) >= std::abs(remaining);
+            if (clipped) dt = remaining;
+
+            predict(dt);
+            double dtNew = step(positions, velocities, dt, pull);
+
+            if (std::abs(dtNew) < safety * std::abs(dt) && std::abs(dt) > smallest) {
+                dt = std::copysign(std::max(std::abs(dtNew), smallest), span); // again, shorter
+                continue;
+            }
+
+            accept(positions, velocities, dt);
+            done += dt;
+            steps++;
+            finished = clipped;
+
+            // Cutting the step short to land on the end doesn't make the next one shorter
+            const double proposed = clipped ? std::max(std::abs(dtNew), std::abs(nextStep)) : std::abs(dtNew);
+            nextStep = std::copysign(std::max(proposed, smallest), span);
+            lastStep = dt;
+
+            pull(positions, a0);
+            dt = nextStep;
+        }
+        return steps;
+    }
+
+    // Accelerations at the positions integrate() ended on
+    const std::vector<glm::dvec2>& endAccelerations() const { return a0; }
+
+private:
+    static constexpr double safety = 0.25;  // steps this much shorter than tried are done again, and they grow at most 1 / this
+
+    // Gauss-Radau spacings over [0, 1]
+    static constexpr double nodes[8] = {
+        0.0,
+        0.0562625605369221464656521910318,
+        0.180240691736892364987579942780,
+        0.352624717113169637373907769648,
+        0.547153626330555383001448554766,
+        0.734210177215410531523210605558,
+        0.885320946839095768090359771030,
+        0.977520613561287501891174488626,
+    };
+
+    using Coefficients = std::array<glm::dvec2, 7>;
+
+    size_t count = 0;
+    double nextStep = 0.0;
+    double lastStep = 0.0;
+    double c[7][7] = {};        // b_j = sum_k c[k][j] g_k (g are the same polynomial in Newton form)
+    bool ready = false;
+
+    std::vector<Coefficients> b, e, g, acceptedB, acceptedE;
+    std::vector<glm::dvec2> a0, trial, accelerations, positionError, velocityError;
+
+    // The Newton basis s (s - h1) ... (s - hk) written out in powers of s gives c
+    void setup() {
+        if (ready) return;
+        double poly[8] = { 0.0, 1.0 }; // s
+        for (int k = 0; k < 7; ++k) {
+            if (k > 0) {
+                for (int p = 7; p > 0; --p) {
+                    poly[p] = poly[p - 1] - nodes[k] * poly[p];
+                }
+                poly[0] = -nodes[k] * poly[0];
+            }
+            for (int j = 0; j < 7; ++j) {
+                c[k][j] = poly[j + 1];
+            }
+        }
+        ready = true;
+    }
+
+    void resize(size_t n) {
+        count = n;
+        nextStep = 0.0;
+        lastStep = 0.0;
+        const Coefficients zero = {};
+        b.assign(n, zero);
+        e.assign(n, zero);
+        g.assign(n, zero);
+        acceptedB.assign(n, zero);
+        acceptedE.assign(n, zero);
+        a0.resize(n);
+        trial.resize(n);
+        accelerations.resize(n);
+        positionError.assign(n, glm::dvec2(0.0));
+        velocityError.assign(n, glm::dvec2(0.0));
+    }
+
+    // The b from the last step that went through, moved to the start of a step of length dt.
+    // That's the polynomial a(s) re-expanded at its end, plus what the predictor missed last time.
+    void predict(double dt) {
+        const double ratio = lastStep != 0.0 ? dt / lastStep : 0.0;
+        if (ratio == 0.0 || std::abs(ratio) > 20.0) {
+            const Coefficients zero = {};
+            std::fill(b.begin(), b.end(), zero);
+            std::fill(e.begin(), e.end(), zero);
+            return;
+        }
+
+        // e_k = ratio^(k+1) sum_j>=k C(j+1, k+1) b_j
+        static const double binomial[7][7] = {
+            { 1, 2, 3, 4, 5, 6, 7 },
+            { 0, 1, 3, 6, 10, 15, 21 },
+            { 0, 0, 1, 4, 10, 20, 35 },
+            { 0, 0, 0, 1, 5, 15, 35 },
+            { 0, 0, 0, 0, 1, 6, 21 },
+            { 0, 0, 0, 0, 0, 1, 7 },
+            { 0, 0, 0, 0, 0, 0, 1 },
+        };
+        double powers[7];
+        powers[0] = ratio;
+        for (int k = 1; k < 7; ++k) powers[k] = powers[k - 1] * ratio;
+
+        for (size_t i = 0; i < count; ++i) {
+            const Coefficients& last = acceptedB[i];
+            for (int k = 0; k < 7; ++k) {
+                glm::dvec2 sum(0.0);
+                for (int j = k; j < 7; ++j) sum += binomial[k][j] * last[j];
+                e[i][k] = powers[k] * sum;
+                b[i][k] = e[i][k] + (last[k] - acceptedE[i][k]);
+            }
+        }
+    }
+
+    // One try at a step of dt from the current positions, velocities and a0. Leaves the b
+    // and returns the step the error estimate asks for.
+    template <typename Pull>
+    double step(const std::vector<glm::dvec2>& positions, const std::vector<glm::dvec2>& velocities, double dt, Pull pull) {
+        // g from b, back substitution through c (it's triangular with ones on the diagonal)
+        for (size_t i = 0; i < count; ++i) {
+            for (int k = 6; k >= 0; --k) {
+                glm::dvec2 value = b[i][k];
+                for (int m = k + 1; m < 7; ++m) value -= c[m][k] * g[i][m];
+                g[i][k] = value;
+            }
+        }
+
+        double lastCorrection = 0.0;
+        for (int iteration = 0; iteration < 12; ++iteration) {
+            double biggestChange = 0.0;
+            double biggestPull = 0.0;
+
+            for (int n = 1; n < 8; ++n) {
+                const double s = nodes[n];
+                for (size_t i = 0; i < count; ++i) {
+                    const Coefficients& bi = b[i];
+                    glm::dvec2 series = a0[i] * 0.5 + s * (bi[0] / 6.0 + s * (bi[1] / 12.0 + s * (bi[2] / 20.0 + s * (bi[3] / 30.0
+                                      + s * (bi[4] / 42.0 + s * (bi[5] / 56.0 + s * bi[6] / 72.0))))));
+                    trial[i] = positions[i] + s * dt * (velocities[i] + s * dt * series);
+                }
+
+                pull(trial, accelerations);
+
+                // Newton divided differences give g_(n-1), the b follow its change
+                for (size_t i = 0; i < count; ++i) {
+                    glm::dvec2 value = (accelerations[i] - a0[i]) / (nodes[n] - nodes[0]);
+                    for (int k = 0; k < n - 1; ++k) {
+                        value = (value - g[i][k]) / (nodes[n] - nodes[k + 1]);
+                    }
+                    glm::dvec2 change = value - g[i][n - 1];
+                    g[i][n - 1] = value;
+                    for (int j = 0; j < n; ++j) {
+                        b[i][j] += c[n - 1][j] * change;
+                    }
+
+                    if (n == 7) {
+                        biggestChange = std::max(biggestChange, glm::length(change));
+                        biggestPull = std::max(biggestPull, glm::length(accelerations[i]));
+                    }
+                }
+            }
+
+            // Converged, or round-off noise has stopped it getting any better
+            double correction = biggestPull > 0.0 ? biggestChange / biggestPull : 0.0;
+            if (correction < 1e-16) break;
+            if (iteration > 1 && correction >= lastCorrection) break;
+            lastCorrection = correction;
+        }
+
+        double biggestB6 = 0.0;
+        double biggestPull = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            biggestB6 = std::max(biggestB6, glm::length(b[i][6]));
+            biggestPull = std::max(biggestPull, glm::length(a0[i]));
+        }
+
+        const double error = biggestPull > 0.0 ? biggestB6 / biggestPull : 0.0;
+        if (!(error > 0.0) || !std::isfinite(error)) return dt / safety;
+
+        double dtNew = dt * std::pow(accuracy / error, 1.0 / 7.0);
+        if (std::abs(dtNew) > std::abs(dt) / safety) dtNew = dt / safety;
+        return dtNew;
+    }
+
+    // The step went through: integrate the polynomial over all of it, with compensated sums
+    void accept(std::vector<glm::dvec2>& positions, std::vector<glm::dvec2>& velocities, double dt) {
+        for (size_t i = 0; i < count; ++i) {
+            const Coefficients& bi = b[i];
+            glm::dvec2 dx = dt * velocities[i] + dt * dt * (a0[i] * 0.5 + bi[0] / 6.0 + bi[1] / 12.0 + bi[2] / 20.0
+                          + bi[3] / 30.0 + bi[4] / 42.0 + bi[5] / 56.0 + bi[6] / 72.0);
+            glm::dvec2 dv = dt * (a0[i] + bi[0] / 2.0 + bi[1] / 3.0 + bi[2] / 4.0 + bi[3] / 5.0 + bi[4] / 6.0 + bi[5] / 7.0 + bi[6] / 8.0);
+
+            addCompensated(positions[i], positionError[i], dx);
+            addCompensated(velocities[i], velocityError[i], dv);
+        }
+        acceptedB = b;
+        acceptedE = e;
+    }
+
+    // Kahan summation, the low bits that didn't fit into sum wait in error for the next add
+    static void addCompensated(glm::dvec2& sum, glm::dvec2& error, glm::dvec2 add) {
+        glm::dvec2 y = add - error;
+        glm::dvec2 t = sum + y;
+        error = (t - sum) - y;
+        sum = t;
+    }
+};
+
+
+#endif
@@ -35,6 +35,26 @@ struct CelestialBody {
 };
 
 
+// Which algorithm updatePhysics uses to compute gravity
+enum ForceSolver { DIRECT_SUM, BARNES_HUT, FAST_MULTIPOLE, PARTICLE_MESH, P3M };
+
+// How the particle mesh spreads a body's mass over the grid
+enum MassAssignment { CIC, TSC }; // Cloud-In-Cell (2x2 cells), Triangular-Shaped-Cloud (3x3 cells)
+
+// How many terms of a far tree cell's expansion the Barnes-Hut walk uses
+enum TreeMultipole { MONOPOLE, QUADRUPOLE, OCTUPOLE };
+
+// How the Barnes-Hut solver walks its tree
+enum TreeWalk { PER_BODY, GROUPED, DUAL_TREE }; // one walk per body, one per small group of bodies, cell against cell
+
+// How the tree based solvers find touching bodies (the direct sum spots them in its own loop)
+enum CollisionBroadphase { BODY_TREE, HASH_GRID, SWEEP_AND_PRUNE, BOX_TREE }; // the Barnes-Hut quadtree, a uniform grid rebuilt every step,
+                                                                                // sorted box ends and a tree of fattened boxes kept from step to step
+
+// How updatePhysics moves the bodies over one step
+enum Integrator { SEMI_IMPLICIT_EULER, LEAPFROG, YOSHIDA4, YOSHIDA6, HERMITE, WISDOM_HOLMAN, GAUSS_RADAU }; // 1, 1, 3, 7, 1 (with jerks), 1 and ~15 per inner step force evaluations per step
+
+
 struct AppState {
     std::unique_ptr<Shader> myShader;
     std::unique_ptr<Shader> gridShader;
@@ -42,10 +62,74 @@ struct AppState {
     GLFWwindow* window;
 
     std::vector<CelestialBody> bodies; 
+    bool bodiesChanged = true; // set when bodies are added or removed, so the tree gets rebuilt instead of refit
     float G = 0.01f;
 
+    // Softening factor to prevent infinite force when bodies overlap
+    float softening = 0.01f;
+
+    ForceSolver forceSolver = DIRECT_SUM;
+    float theta = 0.5f; // Barnes-Hut opening angle (0 = exact, bigger = faster but rougher)
+    TreeMultipole treeMultipole = QUADRUPOLE; // with quadrupoles theta can go up to 0.7 and still beat a monopole tree at 0.5
+    TreeWalk treeWalk = GROUPED;
+    bool treeListReuse = true; // grouped walk: keep interaction lists while a group stays put (lists stop at quadrupoles)
+    int fmmOrder = 8;   // FMM expansion order p (bigger = more accurate but slower)
+    int pmGridSize = 256; // Particle mesh cells per side, power of two
+    MassAssignment pmAssignment = CIC;
+    float p3mSplitCells = 6.0f; // P3M short/long range split radius, in mesh cells
+
+    CollisionBroadphase broadphase = BODY_TREE; // the quadtree the tree solvers already build, as before the others existed
+    bool continuousCollisions = false; // find collisions along each body's path over the step, not just where it ends up
+    int lastImpacts = 0;               // collisions the last step found along the paths
+
+    bool periodicBox = false; // wrap space into a box that repeats forever (Ewald summed, direct sum only)
+    float boxSize = 20.0f;    // side of the periodic box, centered on the origin
+
+    int threadCount = 1;  // Physics worker threads (main sets this to the core count)
+
     float lastFrame = 0.0f;
 
+    // Physics runs in fixed steps no matter the frame rate, as many as the frame's time calls for
+    float fixedTimeStep = 1.0f / 120.0f; // simulated seconds per physics step
+    float simulationSpeed = 1.0f;        // simulated seconds per real second
+    int maxSubsteps = 8;                 // per frame, past this the sim slows down instead of falling further behind
+    float stepAccumulator = 0.0f;        // simulated time owed to the physics, less than one step after a frame
+    int lastSubsteps = 0;                // steps run in the last frame (for the UI)
+    Integrator integrator = SEMI_IMPLICIT_EULER; // the original update; leapfrog costs the same and keeps orbits far better
+    bool accelerationsCurrent = false;   // body.acceleration is for the current positions, the next leapfrog step can start with it
+
+    // Block time steps: each body steps at fixedTimeStep / 2^rung with its own rung, and only
+    // the bodies finishing a step get new forces (leapfrog and Hermite)
+    bool blockTimeSteps = false;
+    int maxRung = 8;                     // finest step is fixedTimeStep / 2^maxRung
+    float blockStepAccuracy = 0.025f;    // eta in dt = sqrt(2 eta softening length / |a|)
+    float hermiteStepAccuracy = 0.1f;    // eta in dt = eta |a| / |jerk|, how Hermite picks block steps
+    int lastDeepestRung = 0;             // finest rung used in the last step (for the UI)
+
+    // Wisdom-Holman: bodies orbit the heaviest one analytically, the rest of the pull is a kick
+    float centralDominance = 10.0f;      // the heaviest body has to outweigh all the others this many times
+    float encounterRatio = 0.05f;        // pull from the others / pull from the central body that counts as a close encounter
+    bool lastEncounter = false;          // last step fell back to block step leapfrog (for the UI)
+
+    // Tight bound pairs move along their exact Kepler orbit, everyone else sees one body at their center of mass
+    bool regularizeBinaries = false;
+    float binaryRadius = 0.5f;           // pairs whose whole orbit fits inside this
+    float binaryTidalLimit = 0.01f;      // and where everyone else's tidal pull is below this fraction of their own
+    int lastBoundPairs = 0;              // pairs regularized in the last step (for the UI)
+
+    // Gauss-Radau (IAS15): 15th order in double, picks its own steps inside each step
+    float gaussRadauAccuracy = 1e-9f;    // allowed error of one of its steps, relative to the biggest pull
+    bool gaussRadauEncounters = false;   // leapfrog and Yoshida: bodies about to touch drift with Gauss-Radau
+    float encounterReach = 4.0f;         // closer than this many times their radii (plus a step's travel) is about to touch
+    int lastEncounterBodies = 0;         // bodies in close encounters in the last step (for the UI)
+    int lastGaussRadauSteps = 0;         // Gauss-Radau steps it took for the last step (for the UI)
+
+    // Fast forward: jump ahead with Parareal, time slices integrated in parallel (gravity only)
+    float fastForwardTime = 50.0f;
+    int pararealSlices = 16;
+    int pararealIterations = 6;          // most fine passes before it stops anyway
+    int lastPararealIterations = 0;      // fine passes the last fast forward took (for the UI)
+
     float massInput = 1.0f;
     float velocityInput[2] = { 0.0f, 0.0f };
     float colorInput[3] = { 1.0f, 1.0f, 1.0f };
@@ -0,0 +1,313 @@
+#ifndef GROUPWALK_H
+#define GROUPWALK_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "ThreadPool.hpp"
+#include "SimdKernel.hpp"
+#include "BarnesHut.hpp"
+
+
+// Pull of listed particles on a body at (x, y), without G. Bodies sitting exactly on the
+// body (itself) are skipped like in the direct sum. count is a multiple of GRAVITY_SIMD_LANES.
+glm::vec2 sumParticleList(const float* px, const float* py, const float* pm, size_t count, float x, float y, float softening) {
+    const SimdFloat vx = simdSet(x);
+    const SimdFloat vy = simdSet(y);
+    const SimdFloat vsoft = simdSet(softening);
+    SimdFloat ax = simdSet(0.0f);
+    SimdFloat ay = simdSet(0.0f);
+
+    for (size_t j = 0; j < count; j += GRAVITY_SIMD_LANES) {
+        SimdFloat dx = simdSub(simdLoad(px + j), vx);
+        SimdFloat dy = simdSub(simdLoad(py + j), vy);
+        SimdFloat r2 = simdFma(dx, dx, simdMul(dy, dy));
+
+        // m / ((r^2 + softening) * r)
+        SimdFloat scale = simdDiv(simdMul(simdLoad(pm + j), simdInvSqrt(r2)), simdAdd(r2, vsoft));
+        scale = simdKeepPositive(r2, scale);
+
+        ax = simdFma(dx, scale, ax);
+        ay = simdFma(dy, scale, ay);
+    }
+
+    return glm::vec2(simdSum(ax), simdSum(ay));
+}
+
+
+// Pull of listed cells (center of mass, mass and quadrupole) on a body at (x, y), without G.
+// Same softened expansion as QuadTree::cellAcceleration, in float, with the closed forms of
+// p and q from QuadTree::kernelDerivatives. count is a multiple of GRAVITY_SIMD_LANES.
+glm::vec2 sumCellList(const float* cx, const float* cy, const float* cm, const float* sxx, const float* sxy, const float* syy,
+                      size_t count, float x, float y, float softening, bool quadrupoles) {
+    const SimdFloat vx = simdSet(x);
+    const SimdFloat vy = simdSet(y);
+    const SimdFloat e = simdSet(softening);
+    const SimdFloat three = simdSet(3.0f);
+    SimdFloat ax = simdSet(0.0f);
+    SimdFloat ay = simdSet(0.0f);
+
+    for (size_t c = 0; c < count; c += GRAVITY_SIMD_LANES) {
+        // r = body - center of mass
+        SimdFloat rx = simdSub(vx, simdLoad(cx + c));
+        SimdFloat ry = simdSub(vy, simdLoad(cy + c));
+        SimdFloat r2 = simdFma(rx, rx, simdMul(ry, ry));
+
+        SimdFloat inv = simdInvSqrt(r2);
+        SimdFloat w = simdDiv(simdSet(1.0f), simdAdd(r2, e));
+        SimdFloat invW = simdMul(inv, w);
+
+        // Monopole: -m r / ((r^2 + softening) * r)
+        SimdFloat mono = simdMul(simdLoad(cm + c), invW);
+        SimdFloat gx = simdMul(rx, mono);
+        SimdFloat gy = simdMul(ry, mono);
+
+        if (quadrupoles) {
+            SimdFloat Sxx = simdLoad(sxx + c);
+            SimdFloat Sxy = simdLoad(sxy + c);
+            SimdFloat Syy = simdLoad(syy + c);
+
+            // p = -(3r^2 + e) / (r^3 (r^2 + e)^2), q = (15r^4 + 10er^2 + 3e^2) / (r^5 (r^2 + e)^3)
+            SimdFloat invW2 = simdMul(invW, invW);
+            SimdFloat invW3 = simdMul(invW2, invW);
+            SimdFloat p = simdMul(simdFma(three, r2, e), simdMul(invW2, inv));
+            SimdFloat qTop = simdFma(simdFma(simdSet(15.0f), r2, simdMul(simdSet(10.0f), e)), r2, simdMul(simdMul(three, e), e));
+            SimdFloat q = simdMul(qTop, simdMul(invW3, simdMul(inv, inv)));
+
+            SimdFloat srx = simdFma(Sxx, rx, simdMul(Sxy, ry));
+            SimdFloat sry = simdFma(Sxy, rx, simdMul(Syy, ry));
+            SimdFloat rSr = simdFma(rx, srx, simdMul(ry, sry));
+            SimdFloat trace = simdAdd(Sxx, Syy);
+
+            // -1/2 [(2 S.r + tr(S) r) p + (r.S.r) q r], with p's sign folded in
+            SimdFloat halfP = simdMul(simdSet(0.5f), p);
+            SimdFloat halfQ = simdMul(simdSet(0.5f), simdMul(rSr, q));
+            gx = simdSub(gx, simdSub(simdMul(halfP, simdFma(simdSet(2.0f), srx, simdMul(trace, rx))), simdMul(halfQ, rx)));
+            gy = simdSub(gy, simdSub(simdMul(halfP, simdFma(simdSet(2.0f), sry, simdMul(trace, ry))), simdMul(halfQ, ry)));
+        }
+
+        ax = simdSub(ax, simdKeepPositive(r2, gx));
+        ay = simdSub(ay, simdKeepPositive(r2, gy));
+    }
+
+    return glm::vec2(simdSum(ax), simdSum(ay));
+}
+
+
+// Barnes-Hut with one tree walk per group of bodies instead of one per body.
+// A group is a tree node with at most groupSize bodies. Its walk opens cells against the
+// group's bounding box, so a cell accepted for the group passes the per body test for every
+// body in it, and the result is a shared list of cells and of leaves to sum directly.
+// The lists are then run through the vector kernels above, one body at a time.
+//
+// Lists can be kept for later steps: the walk is done with the group box grown by
+// reuseSlack of its size (or of its cell, for tiny groups), and the list stays good while the group's bodies stay inside that
+// box and the tree keeps its layout (refits only). Source cells move a little in the meantime,
+// which is the price for skipping the walk.
+//
+// Cells in the lists carry up to the quadrupole (an octupole setting is used as quadrupole).
+// 100k body disk, theta 0.7, one thread: per body walk 600 ms, grouped 60 ms with AVX-512
+// (95 ms AVX2, 220 ms scalar), and the error goes down (8.6e-3 to 5.9e-3) since the group's
+// opening test is stricter for most of its bodies.
+class GroupWalk {
+public:
+    int groupSize = 32;
+    bool reuseLists = true;
+    float reuseSlack = 0.1f;
+
+    int listsRebuilt = 0;   // walks done in the last call, for the UI
+
+    void computeAccelerations(const QuadTree& tree, const std::vector<CelestialBody>& bodies, float G, float theta, float softening,
+                              ThreadPool& pool, std::vector<glm::vec2>& acc) {
+        acc.assign(bodies.size(), glm::vec2(0.0f));
+        listsRebuilt = 0;
+        if (tree.nodes.empty() || tree.nodes[0].count == 0) return;
+
+        // New tree layout (or new settings): new groups, no lists
+        if (tree.buildCount != treeBuild || groupSize != builtGroupSize || theta != builtTheta) {
+            findGroups(tree);
+            treeBuild = tree.buildCount;
+            builtGroupSize = groupSize;
+            builtTheta = theta;
+        }
+
+        const bool quadrupoles = tree.multipoleOrder >= 2;
+        const int block = 16;
+        const int taskCount = ((int)groups.size() + block - 1) / block;
+        std::vector<int> taskWalks(taskCount, 0);
+
+        pool.parallelFor(taskCount, [&](int t) {
+            Scratch scratch;
+            int end = std::min((int)groups.size(), (t + 1) * block);
+            for (int g = t * block; g < end; ++g) {
+                Group& group = groups[g];
+                const QuadNode& node = tree.nodes[group.node];
+
+                glm::vec2 minPos, maxPos;
+                groupBounds(tree, bodies, node, minPos, maxPos);
+
+                bool stale = !group.walked || !reuseLists
+                    || glm::any(glm::lessThan(minPos, group.walkMin)) || glm::any(glm::greaterThan(maxPos, group.walkMax));
+                if (stale) {
+                    float extent = std::max(std::max(maxPos.x - minPos.x, maxPos.y - minPos.y), node.halfSize * 2.0f);
+                    glm::vec2 margin = glm::vec2(extent * (reuseLists ? reuseSlack : 0.0f));
+                    group.walkMin = minPos - margin;
+                    group.walkMax = maxPos + margin;
+                    walk(tree, group, theta);
+                    group.walked = true;
+                    taskWalks[t]++;
+                }
+
+                scratch.gather(tree, bodies, group);
+
+                for (int k = node.start; k < node.start + node.count; ++k) {
+                    int i = tree.bodyIndex[k];
+                    glm::vec2 pos = bodies[i].position;
+                    glm::vec2 sum = sumParticleList(scratch.px.data(), scratch.py.data(), scratch.pm.data(), scratch.px.size(), pos.x, pos.y, softening)
+                                  + sumCellList(scratch.cx.data(), scratch.cy.data(), scratch.cm.data(), scratch.sxx.data(), scratch.sxy.data(), scratch.syy.data(),
+                                                scratch.cx.size(), pos.x, pos.y, softening, quadrupoles);
+                    acc[i] = sum * G;
+                }
+            }
+        });
+
+        for (int walks : taskWalks) {
+            listsRebuilt += walks;
+        }
+    }
+
+private:
+    struct Group {
+        int node;
+        bool walked = false;
+        glm::vec2 walkMin{0.0f}, walkMax{0.0f};     // box the list was made for
+        std::vector<int> cells;         // accepted nodes
+        std::vector<int> leaves;        // leaves whose bodies are summed directly
+    };
+
+    // Lists copied out as flat arrays for the kernels, padded with massless entries far away
+    struct Scratch {
+        std::vector<float> px, py, pm;
+        std::vector<float> cx, cy, cm, sxx, sxy, syy;
+
+        void gather(const QuadTree& tree, const std::vector<CelestialBody>& bodies, const Group& group) {
+            px.clear(); py.clear(); pm.clear();
+            for (int leaf : group.leaves) {
+                const QuadNode& node = tree.nodes[leaf];
+                for (int k = node.start; k < node.start + node.count; ++k) {
+                    const CelestialBody& body = bodies[tree.bodyIndex[k]];
+                    px.push_back(body.position.x);
+                    py.push_back(body.position.y);
+                    pm.push_back(body.mass);
+                }
+            }
+            while (px.size() % GRAVITY_SIMD_LANES != 0) {
+                px.push_back(1.0e6f);
+                py.push_back(1.0e6f);
+                pm.push_back(0.0f);
+            }
+
+            cx.clear(); cy.clear(); cm.clear(); sxx.clear(); sxy.clear(); syy.clear();
+            for (int c : group.cells) {
+                const QuadNode& node = tree.nodes[c];
+                cx.push_back(node.centerOfMass.x);
+                cy.push_back(node.centerOfMass.y);
+                cm.push_back(node.mass);
+                sxx.push_back(node.quadrupole[0]);
+                sxy.push_back(node.quadrupole[1]);
+                syy.push_back(node.quadrupole[2]);
+            }
+            while (cx.size() % GRAVITY_SIMD_LANES != 0) {
+                cx.push_back(1.0e6f);
+                cy.push_back(1.0e6f);
+                cm.push_back(0.0f);
+                sxx.push_back(0.0f);
+                sxy.push_back(0.0f);
+                syy.push_back(0.0f);
+            }
+        }
+    };
+
+    std::vector<Group> groups;
+    unsigned int treeBuild = 0;
+    int builtGroupSize = 0;
+    float builtTheta = -1.0f;
+
+    // Biggest nodes with no more than groupSize bodies
+    void findGroups(const QuadTree& tree) {
+        groups.clear();
+
+        std::vector<int> stack = { 0 };
+        while (!stack.empty()) {
+            int n = stack.back();
+            stack.pop_back();
+
+            const QuadNode& node = tree.nodes[n];
+            if (node.count == 0) continue;
+
+            if (node.count <= groupSize || node.firstChild < 0) {
+                Group group;
+                group.node = n;
+                groups.push_back(group);
+                continue;
+            }
+            for (int q = 3; q >= 0; --q) {
+                stack.push_back(node.firstChild + q);
+            }
+        }
+    }
+
+    static void groupBounds(const QuadTree& tree, const std::vector<CelestialBody>& bodies, const QuadNode& node, glm::vec2& minPos, glm::vec2& maxPos) {
+        minPos = maxPos = bodies[tree.bodyIndex[node.start]].position;
+        for (int k = node.start + 1; k < node.start + node.count; ++k) {
+            minPos = glm::min(minPos, bodies[tree.bodyIndex[k]].position);
+            maxPos = glm::max(maxPos, bodies[tree.bodyIndex[k]].position);
+        }
+    }
+
+    // Same opening test as QuadTree::accelerationOn, against the nearest point of the group box
+    void walk(const QuadTree& tree, Group& group, float theta) {
+        group.cells.clear();
+        group.leaves.clear();
+
+        const glm::vec2 boxCenter = (group.walkMin + group.walkMax) * 0.5f;
+        const glm::vec2 boxHalf = (group.walkMax - group.walkMin) * 0.5f;
+        const float thetaSq = theta * theta;
+
+        int stack[4 * 64 + 4];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            int n = stack[--stackSize];
+            const QuadNode& node = tree.nodes[n];
+            if (node.count == 0 || node.mass <= 0.0f) continue;
+
+            glm::vec2 gap = glm::max(glm::abs(node.centerOfMass - boxCenter) - boxHalf, glm::vec2(0.0f));
+            float size = node.halfSize * 2.0f;
+
+            // Never approximate a cell that overlaps the group
+            glm::vec2 apart = glm::abs(node.center - boxCenter);
+            bool overlaps = apart.x <= node.halfSize + boxHalf.x && apart.y <= node.halfSize + boxHalf.y;
+
+            if (!overlaps && size * size < thetaSq * glm::dot(gap, gap)) {
+                group.cells.push_back(n);
+            }
+            else if (node.firstChild < 0) {
+                group.leaves.push_back(n);
+            }
+            else {
+                for (int c = 0; c < 4; ++c) {
+                    stack[stackSize++] = node.firstChild + c;
+                }
+            }
+        }
+    }
+};
+
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef PARAREAL_H
+#define PARAREAL_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "ThreadPool.hpp"
+#include "DirectSum.hpp"
+
+
+// Parareal (Lions, Maday & Turinici 2001): a long run cut into time slices that are
+// integrated at the same time. A cheap coarse integrator G guesses where each slice starts,
+// the expensive fine one F runs every slice from its guess in parallel, and the guesses
+// are corrected in one serial coarse sweep,
+//     U[n+1] = G(U'[n]) + F(U[n]) - G(U[n])     (U' is this iteration's, U last one's)
+// After k iterations the first k slices are exactly the fine run, and usually all of them
+// are within round-off well before that. If it takes k iterations for S slices, the fine
+// work on the critical path is k slices instead of S.
+//
+// Both integrators are kick-drift-kick compositions over a direct sum in double, written
+// to run several at once (one per slice, each on one thread). Collisions are left out, a
+// merge changes which bodies there are and the correction needs the same ones everywhere.
+//
+// On the --parareal benchmark (100 bodies around a star, 16 slices, Yoshida 4 at 0.01 fine,
+// leapfrog at 0.1 coarse) it is within 5e-8 of the serial run after 5 iterations, where the
+// coarse run alone is 5e-2 off. Measured on one core that's 0.27x the serial run (1300 ms
+// against 355 ms), since the 5 passes each do all 16 slices of fine work. With a core per
+// slice, the time would be the coarse sweeps plus one fine slice per pass. The benchmark
+// prints that as a model, about 2x the serial run, not a measurement. It takes more
+// slices, or a coarse run closer to the fine one, to get further.
+class Parareal {
+public:
+    int slices = 8;
+    int maxIterations = 4;
+    double tolerance = 1e-7;        // done when no slice end moved more than this, relative to the size of the system
+
+    double fineStep = 0.01;
+    const double* fineWeights = nullptr;    // stage fractions of the fine step (Yoshida's, or just 1 for leapfrog)
+    int fineStages = 1;
+    double coarseStep = 0.16;               // the coarse one is always leapfrog
+
+    int lastIterations = 0;         // fine passes the last run took
+    double lastChange = 0.0;        // how far the slice ends moved in the last pass, relative
+
+    // Moves the existing bodies on by window. Gravity only, see above.
+    void run(std::vector<CelestialBody>& bodies, float G, float softening, double window, ThreadPool& pool) {
+        members.clear();
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            if (bodies[i].exists) members.push_back((int)i);
+        }
+        const size_t count = members.size();
+        if (count == 0 || window <= 0.0 || slices < 1) return;
+
+        const double span = window / slices;
+        starts.assign(slices + 1, Phase());
+        coarse.assign(slices + 1, Phase());
+        fine.assign(slices + 1, Phase());
+        scratch.resize(slices);
+
+        Phase& first = starts[0];
+        first.positions.resize(count);
+        first.velocities.resize(count);
+        glm::dvec2 center(0.0);
+        for (size_t k = 0; k < count; ++k) {
+            first.positions[k] = glm::dvec2(bodies[members[k]].position);
+            first.velocities[k] = glm::dvec2(bodies[members[k]].velocity);
+            center += first.positions[k];
+        }
+        center /= (double)count;
+
+        // Changes are measured against the RMS distance from the middle
+        double spread = 0.0;
+        for (size_t k = 0; k < count; ++k) {
+            spread += glm::dot(first.positions[k] - center, first.positions[k] - center);
+        }
+        spread = std::max(std::sqrt(spread / count), 1e-12);
+
+        // Iteration 0 is the coarse run alone
+        for (int n = 0; n < slices; ++n) {
+            coarse[n + 1] = starts[n];
+            propagate(bodies, G, softening, coarse[n + 1], span, coarseStep, &leapfrogWeight, 1, scratch[0]);
+            starts[n + 1] = coarse[n + 1];
+        }
+
+        lastIterations = 0;
+        lastChange = 0.0;
+        for (int iteration = 1; iteration <= maxIterations && iteration <= slices; ++iteration) {
+            // Slices before iteration - 1 start exactly right already, their fine run wouldn't change
+            const int firstSlice = iteration - 1;
+            pool.parallelFor(slices - firstSlice, [&](int t) {
+                const int n = firstSlice + t;
+                fine[n + 1] = starts[n];
+                propagate(bodies, G, softening, fine[n + 1], span, fineStep, fineWeights, fineStages, scratch[t]);
+            });
+
+            double change = 0.0;
+            for (int n = firstSlice; n < slices; ++n) {
+                Phase guess = starts[n];
+                propagate(bodies, G, softening, guess, span, coarseStep, &leapfrogWeight, 1, scratch[0]);
+
+                Phase& next = starts[n + 1];
+                for (size_t k = 0; k < count; ++k) {
+                    glm::dvec2 position = guess.positions[k] + fine[n + 1].positions[k] - coarse[n + 1].positions[k];
+                    change = std::max(change, glm::length(position - next.positions[k]));
+                    next.positions[k] = position;
+                    next.velocities[k] = guess.velocities[k] + fine[n + 1].velocities[k] - coarse[n + 1].velocities[k];
+                }
+                coarse[n + 1] = guess;
+            }
+
+            lastIterations = iteration;
+            lastChange = change / spread;
+            if (lastChange < tolerance) break;
+        }
+
+        const Phase& last = starts[slices];
+        for (size_t k = 0; k < count; ++k) {
+            bodies[members[k]].position = glm::vec2(last.positions[k]);
+            bodies[members[k]].velocity = glm::vec2(last.velocities[k]);
+        }
+    }
+
+    // The fine integrator alone over the whole window, one slice after the other. What run()
+    // converges to, for checking it.
+    void runSerial(std::vector<CelestialBody>& bodies, float G, float softening, double window) {
+        members.clear();
+        Phase phase;
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            if (!bodies[i].exists) continue;
+            members.push_back((int)i);
+            phase.positions.push_back(glm::dvec2(bodies[i].position));
+            phase.velocities.push_back(glm::dvec2(bodies[i].velocity));
+        }
+        scratch.resize(1);
+
+        for (int n = 0; n < slices; ++n) {
+            propagate(bodies, G, softening, phase, window / slices, fineStep, fineWeights, fineStages, scratch[0]);
+        }
+
+        for (size_t k = 0; k < members.size(); ++k) {
+            bodies[members[k]].position = glm::vec2(phase.positions[k]);
+            bodies[members[k]].velocity = glm::vec2(phase.velocities[k]);
+        }
+    }
+
+private:
+    struct Phase {
+        std::vector<glm::dvec2> positions;
+        std::vector<glm::dvec2> velocities;
+    };
+
+    static constexpr double leapfrogWeight = 1.0;
+
+    std::vector<int> members;
+    std::vector<Phase> starts;          // where each slice starts, this iteration's guess
+    std::vector<Phase> coarse;          // coarse run of each slice from last iteration's start
+    std::vector<Phase> fine;            // fine run of each slice from last iteration's start
+    std::vector<std::vector<glm::dvec2>> scratch;   // accelerations, one per task
+
+    // Kick-drift-kick stages over span, in whole steps of about step (the last one isn't
+    // shorter, the span is cut evenly). Only touches phase and acc, so runs can overlap.
+    void propagate(const std::vector<CelestialBody>& bodies, float G, float softening, Phase& phase,
+                   double span, double step, const double* weights, int stages, std::vector<glm::dvec2>& acc) const {
+        const size_t count = members.size();
+        const int steps = std::max(1, (int)std::ceil(span / step - 1e-9));
+        const double dt = span / steps;
+        acc.resize(count);
+
+        accumulateDoubleRows(bodies, members, phase.positions, G, softening, 0, count, acc);
+        for (int s = 0; s < steps; ++s) {
+            for (int stage = 0; stage < stages; ++stage) {
+                const double h = weights[stage] * dt;
+                for (size_t k = 0; k < count; ++k) {
+                    phase.velocities[k] += acc[k] * (0.5 * h);
+                    phase.positions[k] += phase.velocities[k] * h;
+                }
+                accumulateDoubleRows(bodies, members, phase.positions, G, softening, 0, count, acc);
+                for (size_t k = 0; k < count; ++k) {
+                    phase.velocities[k] += acc[k] * (0.5 * h);
+                }
+            }
+        }
+    }
+};
+
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef PARTICLEMESH_H
+#define PARTICLEMESH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+#include "Globals.hpp"
+#include "FFT.hpp"
+
+
+// Particle-Mesh gravity. O(N + M^2 log M) for an M x M mesh.
+//
+// Mass is deposited onto the mesh (CIC or TSC), convolved with the force kernel using
+// FFTs, and the mesh accelerations are interpolated back with the same weights.
+// The mesh is zero padded to 2M x 2M so the convolution doesn't wrap around, which
+// gives isolated (open space) boundaries instead of a periodic box.
+//
+// We convolve with the force itself, G * d / ((r^2 + softening) * r), rather than
+// solving for a potential and differencing it. That matches the direct sum's force law
+// exactly and needs no finite difference step. x and y ride along as the real and
+// imaginary parts of one complex kernel, so the whole solve is 3 FFTs.
+//
+// Forces are smoothed below a couple of cells, so this is meant for big smooth runs.
+// With splitRadius set, only the long range part of the force goes on the mesh (see P3M).
+class ParticleMesh {
+public:
+    int gridSize = 256;                  // M, must be a power of two
+    MassAssignment assignment = CIC;
+    double splitCells = 0.0;             // > 0 leaves everything closer than this many cells to a short range solver
+
+    // Share of the force handled at short range, 1 at r = 0 down to 0 at r = splitRadius.
+    // A quintic smoothstep, so the long range remainder is smooth enough for the mesh and
+    // the short range part is exactly zero past the cutoff (no truncation error).
+    static double shortRangeFactor(double distance, double splitRadius) {
+        if (distance >= splitRadius) return 0.0;
+
+        double u = distance / splitRadius;
+        return 1.0 - u * u * u * (10.0 + u * (-15.0 + 6.0 * u));
+    }
+
+    void computeAccelerations(std::vector<CelestialBody>& bodies, float G, float softening) {
+
+        for (auto& body : bodies) {
+            body.acceleration = glm::vec2(0.0f);
+        }
+        if (!fitGrid(bodies)) return;
+
+        const int M = gridSize;
+        const int P = 2 * M; // padded size
+
+        // Deposit mass (cell centers sit at integer grid coordinates)
+        density.assign((size_t)P * P, std::complex<double>(0.0));
+        for (const auto& body : bodies) {
+            if (!body.exists) continue;
+
+            int ix, iy;
+            double wx[3], wy[3];
+            int taps = weights(body.position, ix, iy, wx, wy);
+
+            for (int b = 0; b < taps; ++b) {
+                for (int a = 0; a < taps; ++a) {
+                    density[(size_t)(iy + b) * P + (ix + a)] += body.mass * wx[a] * wy[b];
+                }
+            }
+        }
+
+        // Force kernel for every target - source cell offset, negative offsets wrap to the far end.
+        // The pull points back along the offset, hence the minus sign.
+        kernel.assign((size_t)P * P, std::complex<double>(0.0));
+        for (int dy = -M + 1; dy < M; ++dy) {
+            for (int dx = -M + 1; dx < M; ++dx) {
+                if (dx == 0 && dy == 0) continue; // no self force
+
+                double x = dx * cellSize;
+                double y = dy * cellSize;
+                double distanceSq = x * x + y * y;
+                double scale = -G * kernelScale(distanceSq, softening);
+
+                kernel[(size_t)((dy + P) % P) * P + (dx + P) % P] = std::complex<double>(x * scale, y * scale);
+            }
+        }
+
+        twiddles.build(P);
+        fft2D(density, P, false, twiddles, M);
+        fft2D(kernel, P, false, twiddles);
+
+        for (size_t k = 0; k < density.size(); ++k) {
+            density[k] *= kernel[k];
+        }
+
+        fft2D(density, P, true, twiddles);
+
+        // density now holds the mesh acceleration (x in real, y in imaginary), unscaled by the inverse FFT
+        const double norm = 1.0 / ((double)P * P);
+
+        for (auto& body : bodies) {
+            if (!body.exists) continue;
+
+            int ix, iy;
+            double wx[3], wy[3];
+            int taps = weights(body.position, ix, iy, wx, wy);
+
+            std::complex<double> sum(0.0);
+            for (int b = 0; b < taps; ++b) {
+                for (int a = 0; a < taps; ++a) {
+                    sum += density[(size_t)(iy + b) * P + (ix + a)] * (wx[a] * wy[b]);
+                }
+            }
+            sum *= norm;
+
+            body.acceleration = glm::vec2((float)sum.real(), (float)sum.imag());
+        }
+    }
+
+    double getCellSize() const { return cellSize; }
+    double getSplitRadius() const { return splitRadius; }
+
+protected:
+    double originX = 0.0, originY = 0.0;
+    double cellSize = 1.0;
+    double splitRadius = 0.0;
+
+    std::vector<std::complex<double>> density;
+    std::vector<std::complex<double>> kernel;
+    FFTTwiddles twiddles;                // for the padded size, rebuilt only when it changes
+
+    // 1 / ((r^2 + softening) * r), the magnitude of the force law divided by r (long range part only when split)
+    double kernelScale(double distanceSq, double softening) const {
+        double distance = std::sqrt(distanceSq);
+        double scale = 1.0 / ((distanceSq + softening) * distance);
+
+        if (splitRadius > 0.0) {
+            scale *= 1.0 - shortRangeFactor(distance, splitRadius);
+        }
+        return scale;
+    }
+
+    // Sizes the mesh so every body (plus its assignment stencil) lands inside it
+    bool fitGrid(const std::vector<CelestialBody>& bodies) {
+        glm::vec2 minPos(0.0f), maxPos(0.0f);
+        bool first = true;
+        for (const auto& body : bodies) {
+            if (!body.exists) continue;
+
+            if (first) {
+                minPos = maxPos = body.position;
+                first = false;
+            }
+            else {
+                minPos = glm::min(minPos, body.position);
+                maxPos = glm::max(maxPos, body.position);
+            }
+        }
+        if (first) return false;
+
+        // Keep 2 spare cells on each side for the stencils
+        double extent = std::max(maxPos.x - minPos.x, maxPos.y - minPos.y);
+        cellSize = std::max(extent, 0.001) / (gridSize - 4);
+        originX = (minPos.x + maxPos.x) * 0.5 - cellSize * (gridSize - 1) * 0.5;
+        originY = (minPos.y + maxPos.y) * 0.5 - cellSize * (gridSize - 1) * 0.5;
+        splitRadius = splitCells * cellSize;
+        return true;
+    }
+
+    // First cell touched and the per-axis weights. Returns the stencil width (2 for CIC, 3 for TSC).
+    int weights(glm::vec2 position, int& ix, int& iy, double* wx, double* wy) const {
+        double gx = (position.x - originX) / cellSize;
+        double gy = (position.y - originY) / cellSize;
+
+        if (assignment == TSC) {
+            ix = (int)std::floor(gx + 0.5) - 1;
+            iy = (int)std::floor(gy + 0.5) - 1;
+            tscWeights(gx - (ix + 1), wx);
+            tscWeights(gy - (iy + 1), wy);
+            return 3;
+        }
+
+        ix = (int)std::floor(gx);
+        iy = (int)std::floor(gy);
+        double fx = gx - ix;
+        double fy = gy - iy;
+        wx[0] = 1.0 - fx; wx[1] = fx;
+        wy[0] = 1.0 - fy; wy[1] = fy;
+        return 2;
+    }
+
+    static void tscWeights(double d, double* w) {
+        w[0] = 0.5 * (0.5 - d) * (0.5 - d);
+        w[1] = 0.75 - d * d;
+        w[2] = 0.5 * (0.5 + d) * (0.5 + d);
+    }
+};
+
+
+#endif
@@ -0,0 +1,339 @@
+#ifndef SIMDKERNEL_H
+#define SIMDKERNEL_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+#include "Globals.hpp"
+#include "ThreadPool.hpp"
+
+
+// Lanes the direct-sum kernel runs with, picked from the compiler's target flags
+// (see GRAVITYSIM_NATIVE_ARCH in CMakeLists.txt). 1 means plain scalar code.
+// MSVC never defines __FMA__, but its /arch:AVX2 (what CMakeLists.txt passes it) includes
+// FMA, so __AVX2__ alone is enough there.
+#if defined(__AVX512F__)
+    #define GRAVITY_SIMD_LANES 16
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+    #define GRAVITY_SIMD_LANES 8
+#else
+    #define GRAVITY_SIMD_LANES 1
+#endif
+
+
+// Thin wrappers over the vector types, so smaller kernels can be written once for every lane count
+#if GRAVITY_SIMD_LANES == 16
+    typedef __m512 SimdFloat;
+    SimdFloat simdSet(float v) { return _mm512_set1_ps(v); }
+    SimdFloat simdLoad(const float* p) { return _mm512_loadu_ps(p); }
+    SimdFloat simdAdd(SimdFloat a, SimdFloat b) { return _mm512_add_ps(a, b); }
+    SimdFloat simdSub(SimdFloat a, SimdFloat b) { return _mm512_sub_ps(a, b); }
+    SimdFloat simdMul(SimdFloat a, SimdFloat b) { return _mm512_mul_ps(a, b); }
+    SimdFloat simdDiv(SimdFloat a, SimdFloat b) { return _mm512_div_ps(a, b); }
+    SimdFloat simdFma(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm512_fmadd_ps(a, b, c); }
+    SimdFloat simdKeepPositive(SimdFloat test, SimdFloat v) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(test, _mm512_setzero_ps(), _CMP_GT_OQ), v); }
+    float simdSum(SimdFloat v) { return _mm512_reduce_add_ps(v); }
+    SimdFloat simdInvSqrt(SimdFloat r2) {
+        SimdFloat inv = _mm512_rsqrt14_ps(r2);
+        return _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(simdSet(0.5f), r2), _mm512_mul_ps(inv, inv), simdSet(1.5f)));
+    }
+#elif GRAVITY_SIMD_LANES == 8
+    typedef __m256 SimdFloat;
+    SimdFloat simdSet(float v) { return _mm256_set1_ps(v); }
+    SimdFloat simdLoad(const float* p) { return _mm256_loadu_ps(p); }
+    SimdFloat simdAdd(SimdFloat a, SimdFloat b) { return _mm256_add_ps(a, b); }
+    SimdFloat simdSub(SimdFloat a, SimdFloat b) { return _mm256_sub_ps(a, b); }
+    SimdFloat simdMul(SimdFloat a, SimdFloat b) { return _mm256_mul_ps(a, b); }
+    SimdFloat simdDiv(SimdFloat a, SimdFloat b) { return _mm256_div_ps(a, b); }
+    SimdFloat simdFma(SimdFloat a, SimdFloat b, SimdFloat c) { return _mm256_fmadd_ps(a, b, c); }
+    SimdFloat simdKeepPositive(SimdFloat test, SimdFloat v) { return _mm256_and_ps(v, _mm256_cmp_ps(test, _mm256_setzero_ps(), _CMP_GT_OQ)); }
+    float simdSum(SimdFloat v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_hadd_ps(s, s);
+        s = _mm_hadd_ps(s, s);
+        return _mm_cvtss_f32(s);
+    }
+    SimdFloat simdInvSqrt(SimdFloat r2) {
+        SimdFloat inv = _mm256_rsqrt_ps(r2);
+        return _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(simdSet(0.5f), r2), _mm256_mul_ps(inv, inv), simdSet(1.5f)));
+    }
+#else
+    typedef float SimdFloat;
+    SimdFloat simdSet(float v) { return v; }
+    SimdFloat simdLoad(const float* p) { return *p; }
+    SimdFloat simdAdd(SimdFloat a, SimdFloat b) { return a + b; }
+    SimdFloat simdSub(SimdFloat a, SimdFloat b) { return a - b; }
+    SimdFloat simdMul(SimdFloat a, SimdFloat b) { return a * b; }
+    SimdFloat simdDiv(SimdFloat a, SimdFloat b) { return a / b; }
+    SimdFloat simdFma(SimdFloat a, SimdFloat b, SimdFloat c) { return a * b + c; }
+    SimdFloat simdKeepPositive(SimdFloat test, SimdFloat v) { return test > 0.0f ? v : 0.0f; }
+    float simdSum(SimdFloat v) { return v; }
+    SimdFloat simdInvSqrt(SimdFloat r2) { return 1.0f / std::sqrt(r2); }
+#endif
+
+
+// Structure-of-arrays copy of the hot body data. CelestialBody is ~330 bytes (mostly the
+// ID string), this is 20 bytes per body, so the force loop streams only what it reads.
+// Arrays are padded to a multiple of 16 with massless bodies parked far away.
+struct BodyArrays {
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> mass;
+    std::vector<float> solidMass;    // mass as seen by debris (0 for debris, they don't pull each other)
+    std::vector<float> radius;
+    std::vector<unsigned char> isDebris;
+    size_t count = 0;
+
+    void pack(const std::vector<CelestialBody>& bodies) {
+        count = bodies.size();
+        size_t padded = (count + 15) / 16 * 16;
+
+        x.assign(padded, 1.0e15f);
+        y.assign(padded, 1.0e15f);
+        mass.assign(padded, 0.0f);
+        solidMass.assign(padded, 0.0f);
+        radius.assign(padded, 0.0f);
+        isDebris.assign(padded, 0);
+
+        for (size_t i = 0; i < count; ++i) {
+            const CelestialBody& body = bodies[i];
+            x[i] = body.position.x;
+            y[i] = body.position.y;
+            if (!body.exists) continue; // removed bodies keep mass 0 and can't collide
+
+            mass[i] = body.mass;
+            solidMass[i] = body.isDebris ? 0.0f : body.mass;
+            radius[i] = body.radius;
+            isDebris[i] = body.isDebris ? 1 : 0;
+        }
+    }
+};
+
+
+// Rows handled together, and how many source bodies they sweep at a time. A tile of
+// 1024 bodies is ~20KB of x/y/mass/radius, so it stays in L1 while every row of the
+// block runs over it instead of streaming all N bodies from memory once per row.
+const size_t SIMD_ROW_BLOCK = 32;
+const size_t SIMD_TILE_BODIES = 1024;
+
+
+// Full rows i in [iBegin, iEnd) against every j, written (not added) into acc[i].
+// This is the non-symmetric form: each row only writes its own result, so rows can be
+// split between threads freely and the j loop vectorizes. Tiling doesn't change the order
+// a row adds up its j's, so results don't depend on how rows were split up.
+//
+// 1/r comes from the hardware reciprocal square root (~12 bits) plus one Newton step,
+// which gets it to ~22 bits. Against the scalar symmetric kernel the worst body lands
+// within ~2e-5 of the RMS acceleration (20k random bodies), about the same as the scalar
+// build's own summation order noise. `GravitySim --benchmark N` checks it against 1e-4.
+//
+// Overlapping pairs with j > i are appended to overlaps, in ascending (i, j) order.
+//
+// With a rows list the rows are rows[iBegin] ... rows[iEnd - 1] instead (the bodies on the
+// active rung of a block step). Then every overlap with another body is reported as
+// (smaller, bigger), and a pair with both ends in the list shows up twice.
+void simdAccumulateRows(const BodyArrays& soa, size_t iBegin, size_t iEnd, float G, float softening,
+                        glm::vec2* acc, std::vector<std::pair<int, int>>& overlaps, const int* rows = nullptr) {
+
+    const size_t firstOverlap = overlaps.size();
+
+#if GRAVITY_SIMD_LANES > 1
+    const size_t sweepEnd = soa.x.size(); // padded, the vector loop runs over the dummies too
+#else
+    const size_t sweepEnd = soa.count;
+#endif
+
+    for (size_t i0 = iBegin; i0 < iEnd; i0 += SIMD_ROW_BLOCK) {
+        const size_t i1 = std::min(iEnd, i0 + SIMD_ROW_BLOCK);
+
+#if GRAVITY_SIMD_LANES == 16
+        __m512 vax[SIMD_ROW_BLOCK];
+        __m512 vay[SIMD_ROW_BLOCK];
+        for (size_t r = 0; r < SIMD_ROW_BLOCK; ++r) {
+            vax[r] = _mm512_setzero_ps();
+            vay[r] = _mm512_setzero_ps();
+        }
+        const __m512 vsoft = _mm512_set1_ps(softening);
+        const __m512 half = _mm512_set1_ps(0.5f);
+        const __m512 threeHalves = _mm512_set1_ps(1.5f);
+#elif GRAVITY_SIMD_LANES == 8
+        __m256 vax[SIMD_ROW_BLOCK];
+        __m256 vay[SIMD_ROW_BLOCK];
+        for (size_t r = 0; r < SIMD_ROW_BLOCK; ++r) {
+            vax[r] = _mm256_setzero_ps();
+            vay[r] = _mm256_setzero_ps();
+        }
+        const __m256 vsoft = _mm256_set1_ps(softening);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256 zero = _mm256_setzero_ps();
+#else
+        float ax[SIMD_ROW_BLOCK] = {};
+        float ay[SIMD_ROW_BLOCK] = {};
+#endif
+
+        for (size_t j0 = 0; j0 < sweepEnd; j0 += SIMD_TILE_BODIES) {
+            const size_t j1 = std::min(sweepEnd, j0 + SIMD_TILE_BODIES);
+
+            for (size_t row = i0; row < i1; ++row) {
+                const size_t r = row - i0;
+                const size_t i = rows ? (size_t)rows[row] : row;
+                const float xi = soa.x[i];
+                const float yi = soa.y[i];
+                const float ri = soa.radius[i];
+                const float* sourceMass = soa.isDebris[i] ? soa.solidMass.data() : soa.mass.data();
+
+#if GRAVITY_SIMD_LANES == 16
+                const __m512 vxi = _mm512_set1_ps(xi);
+                const __m512 vyi = _mm512_set1_ps(yi);
+                const __m512 vri = _mm512_set1_ps(ri);
+
+                for (size_t j = j0; j < j1; j += 16) {
+                    __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&soa.x[j]), vxi);
+                    __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&soa.y[j]), vyi);
+                    __m512 r2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+
+                    // 1/r with one Newton step: inv * (1.5 - 0.5 * r2 * inv^2)
+                    __m512 inv = _mm512_rsqrt14_ps(r2);
+                    inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), threeHalves));
+
+                    // G*m / ((r^2 + softening) * r), zero for ourselves (r = 0)
+                    __mmask16 nonZero = _mm512_cmp_ps_mask(r2, _mm512_setzero_ps(), _CMP_GT_OQ);
+                    __m512 scale = _mm512_maskz_div_ps(nonZero, _mm512_mul_ps(_mm512_loadu_ps(&sourceMass[j]), inv), _mm512_add_ps(r2, vsoft));
+
+                    vax[r] = _mm512_fmadd_ps(dx, scale, vax[r]);
+                    vay[r] = _mm512_fmadd_ps(dy, scale, vay[r]);
+
+                    __m512 reach = _mm512_add_ps(vri, _mm512_loadu_ps(&soa.radius[j]));
+                    unsigned int hits = _mm512_cmp_ps_mask(r2, _mm512_mul_ps(reach, reach), _CMP_LT_OQ);
+                    for (size_t k = j; hits != 0; ++k, hits >>= 1) {
+                        if ((hits & 1) && (rows ? k != i : k > i) && k < soa.count && !(soa.isDebris[i] && soa.isDebris[k])) {
+                            overlaps.push_back(std::make_pair((int)std::min(i, k), (int)std::max(i, k)));
+                        }
+                    }
+                }
+#elif GRAVITY_SIMD_LANES == 8
+                const __m256 vxi = _mm256_set1_ps(xi);
+                const __m256 vyi = _mm256_set1_ps(yi);
+                const __m256 vri = _mm256_set1_ps(ri);
+
+                for (size_t j = j0; j < j1; j += 8) {
+                    __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&soa.x[j]), vxi);
+                    __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&soa.y[j]), vyi);
+                    __m256 r2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+
+                    // 1/r with one Newton step: inv * (1.5 - 0.5 * r2 * inv^2)
+                    __m256 inv = _mm256_rsqrt_ps(r2);
+                    inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), threeHalves));
+
+                    // G*m / ((r^2 + softening) * r), zero for ourselves (r = 0)
+                    __m256 scale = _mm256_div_ps(_mm256_mul_ps(_mm256_loadu_ps(&sourceMass[j]), inv), _mm256_add_ps(r2, vsoft));
+                    scale = _mm256_and_ps(scale, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+
+                    vax[r] = _mm256_fmadd_ps(dx, scale, vax[r]);
+                    vay[r] = _mm256_fmadd_ps(dy, scale, vay[r]);
+
+                    __m256 reach = _mm256_add_ps(vri, _mm256_loadu_ps(&soa.radius[j]));
+                    unsigned int hits = (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(r2, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+                    for (size_t k = j; hits != 0; ++k, hits >>= 1) {
+                        if ((hits & 1) && (rows ? k != i : k > i) && k < soa.count && !(soa.isDebris[i] && soa.isDebris[k])) {
+                            overlaps.push_back(std::make_pair((int)std::min(i, k), (int)std::max(i, k)));
+                        }
+                    }
+                }
+#else
+                for (size_t j = j0; j < j1; ++j) {
+                    float dx = soa.x[j] - xi;
+                    float dy = soa.y[j] - yi;
+                    float r2 = dx * dx + dy * dy;
+
+                    float reach = ri + soa.radius[j];
+                    if (r2 < reach * reach && (rows ? j != i : j > i) && !(soa.isDebris[i] && soa.isDebris[j])) {
+                        overlaps.push_back(std::make_pair((int)std::min(i, j), (int)std::max(i, j)));
+                    }
+
+                    if (r2 <= 0.0f) continue;
+
+                    float scale = sourceMass[j] / ((r2 + softening) * std::sqrt(r2));
+                    ax[r] += dx * scale;
+                    ay[r] += dy * scale;
+                }
+#endif
+            }
+        }
+
+        // Horizontal sums
+        for (size_t row = i0; row < i1; ++row) {
+            const size_t r = row - i0;
+            const size_t i = rows ? (size_t)rows[row] : row;
+#if GRAVITY_SIMD_LANES == 16
+            float sumX = _mm512_reduce_add_ps(vax[r]);
+            float sumY = _mm512_reduce_add_ps(vay[r]);
+#elif GRAVITY_SIMD_LANES == 8
+            __m128 sx = _mm_add_ps(_mm256_castps256_ps128(vax[r]), _mm256_extractf128_ps(vax[r], 1));
+            __m128 sy = _mm_add_ps(_mm256_castps256_ps128(vay[r]), _mm256_extractf128_ps(vay[r], 1));
+            sx = _mm_hadd_ps(sx, sx);
+            sy = _mm_hadd_ps(sy, sy);
+            sx = _mm_hadd_ps(sx, sx);
+            sy = _mm_hadd_ps(sy, sy);
+            float sumX = _mm_cvtss_f32(sx);
+            float sumY = _mm_cvtss_f32(sy);
+#else
+            float sumX = ax[r];
+            float sumY = ay[r];
+#endif
+            acc[i] = glm::vec2(sumX, sumY) * G;
+        }
+    }
+
+    // Tiles visit (i, j) out of order
+    std::sort(overlaps.begin() + firstOverlap, overlaps.end());
+}
+
+
+// All rows, cut into fixed blocks that the pool hands out. Every block writes only its
+// own rows of acc and its own overlap list, and the lists are joined in block order,
+// so the result is the same for any thread count.
+// Given a list of rows only those are computed, the rest of acc is left at zero.
+void computeDirectSimd(const std::vector<CelestialBody>& bodies, float G, float softening, ThreadPool& pool,
+                       BodyArrays& soa, std::vector<glm::vec2>& acc, std::vector<std::pair<int, int>>& overlaps,
+                       const std::vector<int>* rows = nullptr) {
+
+    soa.pack(bodies);
+    acc.assign(bodies.size(), glm::vec2(0.0f));
+    overlaps.clear();
+
+    const size_t count = rows ? rows->size() : bodies.size();
+    const size_t block = SIMD_ROW_BLOCK * 4;
+    const int taskCount = (int)((count + block - 1) / block);
+
+    static std::vector<std::vector<std::pair<int, int>>> taskOverlaps;
+    taskOverlaps.resize(taskCount);
+
+    pool.parallelFor(taskCount, [&](int t) {
+        size_t begin = t * block;
+        size_t end = std::min(count, begin + block);
+        taskOverlaps[t].clear();
+        simdAccumulateRows(soa, begin, end, G, softening, acc.data(), taskOverlaps[t], rows ? rows->data() : nullptr);
+    });
+
+    for (int t = 0; t < taskCount; ++t) {
+        overlaps.insert(overlaps.end(), taskOverlaps[t].begin(), taskOverlaps[t].end());
+    }
+
+    if (rows) {
+        std::sort(overlaps.begin(), overlaps.end());
+        overlaps.erase(std::unique(overlaps.begin(), overlaps.end()), overlaps.end());
+    }
+}
+
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef SWEEP_AND_PRUNE_H
+#define SWEEP_AND_PRUNE_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Globals.hpp"
+
+
+// Sweep and prune collision broadphase that carries over from step to step (Baraff 1992).
+// The ends of every body's bounding box are kept sorted along x and along y, together
+// with the set of pairs whose boxes overlap. Bodies barely move in a step, so the lists
+// are almost sorted already and an insertion sort puts them right in a few swaps each.
+// Each swap is the only place an overlap can start or end:
+//     a box's lower end passes another's upper end      they may start to overlap
+//     a box's upper end passes another's lower end      they stop overlapping
+// so the pair set is updated from the swaps alone, and nothing else has to be looked at.
+// A step costs about N plus the swaps, plus the narrow phase on the pairs.
+//
+// The set is kept by body index. A body that stops existing is moved to the far end of
+// both lists, which ends its overlaps. When the number of bodies changes (debris added,
+// dead bodies cleared out) indices mean something else, so the lists are sorted from
+// scratch and swept once instead.
+//
+// --collisions (a star, planets, 90% debris going around, steps of 1/120, one thread):
+//     bodies    swaps a body    quadtree    hash grid    sweep and prune    (ms a step)
+//     1000           1           0.27        0.11           0.08
+//     10000          3           4.2         1.3            1.4
+//     100000         6          71          17             20
+// Most of what's left is walking the lists once, the swaps are cheap. Steps twice as long
+// mean twice the swaps, the grid doesn't care.
+class SweepAndPrune {
+public:
+    // Box overlaps that started or ended in the last update (i < j, sorted). After a
+    // rebuild everything counts as started and nothing as ended.
+    std::vector<std::pair<int, int>> added;
+    std::vector<std::pair<int, int>> removed;
+    int lastSwaps = 0;
+    bool lastRebuilt = false;
+
+    void update(const std::vector<CelestialBody>& bodies) {
+        const size_t count = bodies.size();
+
+        boxes.resize(count);
+        const float far = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < count; ++i) {
+            const CelestialBody& body = bodies[i];
+            if (body.exists) {
+                boxes[i] = { body.position - body.radius, body.position + body.radius };
+            }
+            else {
+                boxes[i] = { glm::vec2(far), glm::vec2(far) };
+            }
+        }
+
+        added.clear();
+        removed.clear();
+        changed.clear();
+        lastSwaps = 0;
+        lastRebuilt = count != builtCount;
+
+        if (lastRebuilt) {
+            rebuild();
+            return;
+        }
+
+        for (int axis = 0; axis < 2; ++axis) {
+            for (Endpoint& e : endpoints[axis]) {
+                set(e, boxes[e.id >> 1], axis);
+            }
+            sortAxis(axis);
+        }
+
+        // Only the net change, a pair can start and end again within one update
+        for (const auto& entry : changed) {
+            const bool now = overlapping.count(entry.first) != 0;
+            if (now && !entry.second) added.push_back(unpack(entry.first));
+            if (!now && entry.second) removed.push_back(unpack(entry.first));
+        }
+        std::sort(added.begin(), added.end());
+        std::sort(removed.begin(), removed.end());
+    }
+
+    // Every overlapping pair (i < j, sorted) except debris against debris, from the pairs
+    // whose boxes overlap
+    void findPairs(const std::vector<CelestialBody>& bodies, std::vector<std::pair<int, int>>& pairs) const {
+        pairs.clear();
+        for (uint64_t key : overlapping) {
+            const std::pair<int, int> pair = unpack(key);
+            const CelestialBody& a = bodies[pair.first];
+            const CelestialBody& b = bodies[pair.second];
+            if (a.isDebris && b.isDebris) continue;
+
+            glm::vec2 delta = b.position - a.position;
+            float radiusSum = a.radius + b.radius;
+            if (glm::dot(delta, delta) < radiusSum * radiusSum) {
+                pairs.push_back(pair);
+            }
+        }
+        std::sort(pairs.begin(), pairs.end());
+    }
+
+    // Pairs whose boxes overlap right now
+    size_t boxPairs() const { return overlapping.size(); }
+
+private:
+    struct Box {
+        glm::vec2 lower;
+        glm::vec2 upper;
+    };
+
+    struct Endpoint {
+        float value;
+        int id;             // body * 2, plus 1 for the upper end
+        float across[2];    // the box along the other axis, so a swap doesn't have to look the body up
+    };
+
+    std::vector<Box> boxes;
+    std::vector<Endpoint> endpoints[2];
+    std::unordered_set<uint64_t> overlapping;
+    std::unordered_map<uint64_t, bool> changed;    // pairs touched this update, and whether they overlapped before it
+    std::vector<int> degree;                        // overlapping pairs each body is in
+    std::vector<int> open;
+    std::vector<int> openSlot;
+    size_t builtCount = 0;
+
+    // Upper ends go before lower ends at the same spot, so boxes that only touch don't overlap
+    static bool before(const Endpoint& a, const Endpoint& b) {
+        return a.value < b.value || (a.value == b.value && (a.id & 1) > (b.id & 1));
+    }
+
+    static uint64_t pack(int i, int j) {
+        if (i > j) std::swap(i, j);
+        return ((uint64_t)(uint32_t)i << 32) | (uint32_t)j;
+    }
+
+    static std::pair<int, int> unpack(uint64_t key) {
+        return std::make_pair((int)(key >> 32), (int)(key & 0xffffffffu));
+    }
+
+    static void set(Endpoint& e, const Box& box, int axis) {
+        e.value = (e.id & 1) ? box.upper[axis] : box.lower[axis];
+        e.across[0] = box.lower[1 - axis];
+        e.across[1] = box.upper[1 - axis];
+    }
+
+    bool boxesOverlap(int i, int j) const {
+        const Box& a = boxes[i];
+        const Box& b = boxes[j];
+        return a.lower.x < b.upper.x && b.lower.x < a.upper.x && a.lower.y < b.upper.y && b.lower.y < a.upper.y;
+    }
+
+    void start(int i, int j) {
+        const uint64_t key = pack(i, j);
+        if (overlapping.insert(key).second) {
+            changed.emplace(key, false);
+            degree[i]++;
+            degree[j]++;
+        }
+    }
+
+    // Most ends passing each other belong to boxes that never overlapped, the counts skip
+    // looking those up
+    void end(int i, int j) {
+        if (degree[i] == 0 || degree[j] == 0) return;
+        const uint64_t key = pack(i, j);
+        if (overlapping.erase(key)) {
+            changed.emplace(key, true);
+            degree[i]--;
+            degree[j]--;
+        }
+    }
+
+    // Insertion sort, each end moves down past the ones it's now below
+    void sortAxis(int axis) {
+        std::vector<Endpoint>& list = endpoints[axis];
+        for (size_t k = 1; k < list.size(); ++k) {
+            const Endpoint moving = list[k];
+            size_t m = k;
+            while (m > 0 && before(moving, list[m - 1])) {
+                const Endpoint& passed = list[m - 1];
+                const int i = moving.id >> 1;
+                const int j = passed.id >> 1;
+                if (i != j) {
+                    const bool movingUpper = moving.id & 1;
+                    const bool passedUpper = passed.id & 1;
+                    if (!movingUpper && passedUpper) {
+                        // Only the other axis needs a look. If they end up apart along this
+                        // one, a later swap in this pass ends it again.
+                        if (moving.across[0] < passed.across[1] && passed.across[0] < moving.across[1]) start(i, j);
+                    }
+                    else if (movingUpper && !passedUpper) {
+                        end(i, j);
+                    }
+                }
+                list[m] = passed;
+                --m;
+                lastSwaps++;
+            }
+            list[m] = moving;
+        }
+    }
+
+    // Sort both lists from scratch and sweep x once for the overlaps
+    void rebuild() {
+        const size_t count = boxes.size();
+        builtCount = count;
+        overlapping.clear();
+        degree.assign(count, 0);
+
+        for (int axis = 0; axis < 2; ++axis) {
+            std::vector<Endpoint>& list = endpoints[axis];
+            list.resize(2 * count);
+            for (size_t i = 0; i < count; ++i) {
+                list[2 * i].id = (int)(2 * i);
+                list[2 * i + 1].id = (int)(2 * i + 1);
+                set(list[2 * i], boxes[i], axis);
+                set(list[2 * i + 1], boxes[i], axis);
+            }
+            std::sort(list.begin(), list.end(), before);
+        }
+
+        // Boxes are open along x between their two ends, each new one is checked against the open ones
+        open.clear();
+        openSlot.assign(count, -1);
+        for (const Endpoint& e : endpoints[0]) {
+            const int i = e.id >> 1;
+            if (e.id & 1) {
+                if (openSlot[i] < 0) {
+                    openSlot[i] = -2; // zero width (or gone), closed before it opened
+                    continue;
+                }
+                const int last = open.back();
+                open[openSlot[i]] = last;
+                openSlot[last] = openSlot[i];
+                open.pop_back();
+                openSlot[i] = -1;
+            }
+            else if (openSlot[i] == -1) {
+                for (int j : open) {
+                    if (!boxesOverlap(i, j)) continue;
+                    overlapping.insert(pack(i, j));
+                    degree[i]++;
+                    degree[j]++;
+                }
+                openSlot[i] = (int)open.size();
+                open.push_back(i);
+            }
+        }
+
+        for (uint64_t key : overlapping) added.push_back(unpack(key));
+        std::sort(added.begin(), added.end());
+    }
+};
+
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+
+#ifndef __EMSCRIPTEN__
+    #include <thread>
+    #include <mutex>
+    #include <condition_variable>
+    #include <atomic>
+#endif
+
+
+// How many threads to use when nobody said otherwise
+int defaultThreadCount() {
+#ifdef __EMSCRIPTEN__
+    return 1;
+#else
+    return std::max(1, (int)std::thread::hardware_concurrency());
+#endif
+}
+
+
+// Workers that stay alive between frames, so we don't pay for creating threads every step.
+// parallelFor hands out task indices first come first served and the calling thread helps
+// out, so a pool of size N uses N - 1 extra threads. The web build has no threads and
+// just runs everything inline.
+class ThreadPool {
+public:
+    ThreadPool() {}
+
+    ~ThreadPool() {
+        resize(1);
+    }
+
+    int size() const {
+#ifdef __EMSCRIPTEN__
+        return 1;
+#else
+        return (int)workers.size() + 1;
+#endif
+    }
+
+    void resize(int threadCount) {
+#ifndef __EMSCRIPTEN__
+        threadCount = std::max(1, threadCount);
+        if (threadCount == size()) return;
+
+        // Stop everyone, then start the number we want
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        stopping = false;
+
+        // Workers start from the current generation, or a job posted before they get going would be missed
+        unsigned int startGeneration = generation;
+        for (int t = 1; t < threadCount; ++t) {
+            workers.emplace_back([this, startGeneration]() { workerLoop(startGeneration); });
+        }
+#else
+        (void)threadCount;
+#endif
+    }
+
+    // Calls task(0) ... task(taskCount - 1), spread over the pool. Returns when all are done.
+    void parallelFor(int taskCount, const std::function<void(int)>& task) {
+#ifndef __EMSCRIPTEN__
+        if (!workers.empty() && taskCount > 1) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job = &task;
+                jobTasks = taskCount;
+                nextTask = 0;
+                busyWorkers = (int)workers.size();
+                generation++;
+            }
+            wake.notify_all();
+
+            runTasks();
+
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this]() { return busyWorkers == 0; });
+            job = nullptr;
+            return;
+        }
+#endif
+        for (int t = 0; t < taskCount; ++t) {
+            task(t);
+        }
+    }
+
+private:
+#ifndef __EMSCRIPTEN__
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int)>* job = nullptr;
+    int jobTasks = 0;
+    std::atomic<int> nextTask{0};
+    int busyWorkers = 0;
+    unsigned int generation = 0;
+    bool stopping = false;
+
+    void runTasks() {
+        while (true) {
+            int t = nextTask.fetch_add(1);
+            if (t >= jobTasks) break;
+            (*job)(t);
+        }
+    }
+
+    void workerLoop(unsigned int seen) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+
+            runTasks();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) {
+                done.notify_one();
+            }
+        }
+    }
+#endif
+};
+
+
+#endif
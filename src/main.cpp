@@ -12,6 +12,7 @@
 #include "Camera.hpp"
 #include "Physics.hpp"
 #include "Globals.hpp"
+#include "Benchmark.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -226,7 +227,9 @@ void UpdateFrame(void* arg) {
         deltaTime = 0.1f; 
     }
 
-    float simulationDT = isPaused ? 0.0f : deltaTime;
+    if (isPaused) {
+        state->stepAccumulator = 0.0f;
+    }
 
     state->myShader->use();
 
@@ -261,7 +264,8 @@ void UpdateFrame(void* arg) {
 
     glBindVertexArray(state->bodyShape->VAO);
 
-    updatePhysics(state, simulationDT);
+    // Fixed physics steps, decoupled from how long this frame took
+    float simulationDT = isPaused ? 0.0f : stepPhysics(state, deltaTime);
 
     char selectedID[256] = "";
     if (state->selectedBody) {
@@ -274,9 +278,14 @@ void UpdateFrame(void* arg) {
     }
 
     // remove non-existant bodies
+    size_t bodyCount = state->bodies.size();
     state->bodies.erase(std::remove_if(state->bodies.begin(), state->bodies.end(), 
             [](const CelestialBody& b) { return !b.exists; }), 
             state->bodies.end());
+    if (state->bodies.size() != bodyCount) {
+        state->bodiesChanged = true;
+        state->accelerationsCurrent = false;
+    }
 
 
     state->selectedBody = nullptr;
@@ -404,6 +413,8 @@ void UpdateFrame(void* arg) {
                 newBody.velocity = glm::vec2(state->velocityInput[0], state->velocityInput[1]);
 
                 state->bodies.push_back(newBody);
+                state->bodiesChanged = true;
+                state->accelerationsCurrent = false;
 
                 std::cout << "Added Body at: " << worldX << ", " << worldY << std::endl;
                 std::cout << "ID: " << newID << std::endl;
@@ -483,6 +494,8 @@ void UpdateFrame(void* arg) {
 
                     
                     state->bodies.push_back(newBody);
+                    state->bodiesChanged = true;
+                    state->accelerationsCurrent = false;
 
                     // Reset state
                     state->isPlacingOrbit = false;
@@ -668,8 +681,8 @@ void UpdateFrame(void* arg) {
     if (isPaused) {
         ImGui::SameLine();
         if (ImGui::Button("STEP >", ImVec2(80, 30))) {
-            // Run physics for a tiny, fixed amount of time
-            updatePhysics(state, 0.016f); 
+            // One step, the same size the accumulator runs
+            updatePhysics(state, state->fixedTimeStep);
         }
     }
 
@@ -680,6 +693,8 @@ void UpdateFrame(void* arg) {
         state->isPlacingOrbit = false;
         state->orbitalAnchor = nullptr;
         state->bodies.clear();
+        state->bodiesChanged = true;
+        state->accelerationsCurrent = false;
         std::cout << "Cleared all bodies from the simulation." << std::endl;
     }
 
@@ -699,7 +714,174 @@ void UpdateFrame(void* arg) {
     ImGui::End();
 
     // --- GLOBAL SETTINGS END ---
-    
+
+    // --- PHYSICS SETTINGS BEGIN ---
+
+    ImGui::SetNextWindowPos(ImVec2(10, 590), ImGuiCond_FirstUseEver);
+
+    ImGui::Begin("Physics Settings", NULL, ImGuiWindowFlags_AlwaysAutoResize);
+
+    ImGui::Text("Bodies: %d", (int)state->bodies.size());
+
+#ifndef __EMSCRIPTEN__
+    ImGui::SliderInt("Threads", &state->threadCount, 1, std::max(1, defaultThreadCount()));
+#endif
+
+    const char* solverNames[] = { "Direct Sum", "Barnes-Hut", "Fast Multipole", "Particle Mesh", "P3M" };
+    int solverIndex = (int)state->forceSolver;
+    if (ImGui::Combo("Solver", &solverIndex, solverNames, IM_ARRAYSIZE(solverNames))) {
+        state->forceSolver = (ForceSolver)solverIndex;
+        std::cout << "Force Solver: " << solverNames[solverIndex] << std::endl;
+    }
+
+    if (state->forceSolver == BARNES_HUT) {
+        ImGui::SliderFloat("Theta", &state->theta, 0.0f, 1.5f, "%.2f");
+
+        const char* multipoleNames[] = { "Monopole", "Quadrupole", "Octupole" };
+        int multipoleIndex = (int)state->treeMultipole;
+        if (ImGui::Combo("Multipoles", &multipoleIndex, multipoleNames, IM_ARRAYSIZE(multipoleNames))) {
+            state->treeMultipole = (TreeMultipole)multipoleIndex;
+        }
+
+        const char* walkNames[] = { "Per Body", "Grouped", "Dual Tree" };
+        int walkIndex = (int)state->treeWalk;
+        if (ImGui::Combo("Tree Walk", &walkIndex, walkNames, IM_ARRAYSIZE(walkNames))) {
+            state->treeWalk = (TreeWalk)walkIndex;
+        }
+        if (state->treeWalk == GROUPED) {
+            ImGui::Checkbox("Reuse Lists", &state->treeListReuse);
+        }
+    }
+    else if (state->forceSolver == FAST_MULTIPOLE) {
+        ImGui::SliderInt("Order (p)", &state->fmmOrder, 2, 16);
+    }
+    else if (state->forceSolver == PARTICLE_MESH || state->forceSolver == P3M) {
+        const char* gridNames[] = { "64", "128", "256", "512", "1024" };
+        int gridIndex = 0;
+        while (gridIndex < 4 && (64 << gridIndex) < state->pmGridSize) gridIndex++;
+        if (ImGui::Combo("Grid Size", &gridIndex, gridNames, IM_ARRAYSIZE(gridNames))) {
+            state->pmGridSize = 64 << gridIndex;
+        }
+
+        const char* assignmentNames[] = { "CIC", "TSC" };
+        int assignmentIndex = (int)state->pmAssignment;
+        if (ImGui::Combo("Mass Assignment", &assignmentIndex, assignmentNames, IM_ARRAYSIZE(assignmentNames))) {
+            state->pmAssignment = (MassAssignment)assignmentIndex;
+        }
+
+        if (state->forceSolver == P3M) {
+            ImGui::SliderFloat("Split (cells)", &state->p3mSplitCells, 2.0f, 12.0f, "%.1f");
+        }
+    }
+
+    if (state->forceSolver != DIRECT_SUM || state->integrator == GAUSS_RADAU) {
+        const char* broadphaseNames[] = { "Quadtree", "Hash Grid", "Sweep and Prune", "Box Tree (BVH)" };
+        int broadphaseIndex = (int)state->broadphase;
+        if (ImGui::Combo("Collisions", &broadphaseIndex, broadphaseNames, IM_ARRAYSIZE(broadphaseNames))) {
+            state->broadphase = (CollisionBroadphase)broadphaseIndex;
+        }
+        if (state->broadphase == HASH_GRID) {
+            ImGui::Text("Cell %.3f, %d entries, %d too big", collisionGrid.cellSize, collisionGrid.lastEntries, collisionGrid.lastLarge);
+        }
+        else if (state->broadphase == SWEEP_AND_PRUNE) {
+            ImGui::Text("%d box pairs, %d swaps", (int)sweepAndPrune.boxPairs(), sweepAndPrune.lastSwaps);
+            ImGui::Text("Started %d, ended %d%s", (int)sweepAndPrune.added.size(), (int)sweepAndPrune.removed.size(),
+                        sweepAndPrune.lastRebuilt ? " (rebuilt)" : "");
+        }
+        else if (state->broadphase == BOX_TREE) {
+            ImGui::Text("%d box pairs, %d moved, height %d", (int)collisionBoxTree.boxPairs(), collisionBoxTree.lastMoved,
+                        collisionBoxTree.height());
+        }
+    }
+
+    ImGui::Checkbox("Continuous Collisions", &state->continuousCollisions);
+    if (state->continuousCollisions) {
+        if (state->periodicBox) {
+            ImGui::TextWrapped("Not in the periodic box, collisions are checked at the end of each step there.");
+        }
+        else {
+            ImGui::Text("Impacts last step: %d", state->lastImpacts);
+        }
+    }
+
+    ImGui::Separator();
+    const char* integratorNames[] = { "Semi-Implicit Euler", "Leapfrog (KDK)", "Yoshida 4", "Yoshida 6", "Hermite 4", "Wisdom-Holman", "Gauss-Radau 15" };
+    int integratorIndex = (int)state->integrator;
+    if (ImGui::Combo("Integrator", &integratorIndex, integratorNames, IM_ARRAYSIZE(integratorNames))) {
+        state->integrator = (Integrator)integratorIndex;
+    }
+    if (state->integrator != SEMI_IMPLICIT_EULER && state->integrator != WISDOM_HOLMAN && state->integrator != GAUSS_RADAU) {
+        ImGui::Checkbox("Block Time Steps", &state->blockTimeSteps);
+        if (state->blockTimeSteps) {
+            ImGui::SliderInt("Max Rung", &state->maxRung, 0, 12);
+            if (state->integrator == HERMITE) {
+                ImGui::SliderFloat("Step Accuracy", &state->hermiteStepAccuracy, 0.005f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+            }
+            else {
+                ImGui::SliderFloat("Step Accuracy", &state->blockStepAccuracy, 0.001f, 0.2f, "%.3f", ImGuiSliderFlags_Logarithmic);
+                ImGui::TextWrapped("Block steps are leapfrog (or Hermite).");
+            }
+            ImGui::Text("Finest rung last step: %d", state->lastDeepestRung);
+        }
+    }
+    if (state->integrator == LEAPFROG || state->integrator == YOSHIDA4 || state->integrator == YOSHIDA6) {
+        ImGui::Checkbox("Regularize Binaries", &state->regularizeBinaries);
+        if (state->regularizeBinaries) {
+            ImGui::SliderFloat("Binary Radius", &state->binaryRadius, 0.05f, 5.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Tidal Limit", &state->binaryTidalLimit, 0.001f, 0.1f, "%.3f", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("Regularized pairs: %d", state->lastBoundPairs);
+            if (state->periodicBox) {
+                ImGui::TextWrapped("Not in the periodic box.");
+            }
+        }
+        ImGui::Checkbox("Gauss-Radau Encounters", &state->gaussRadauEncounters);
+        if (state->gaussRadauEncounters) {
+            ImGui::SliderFloat("Encounter Reach", &state->encounterReach, 1.0f, 50.0f, "%.1f radii", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Accuracy", &state->gaussRadauAccuracy, 1e-12f, 1e-4f, "%.0e", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("In encounters: %d bodies, %d steps", state->lastEncounterBodies, state->lastGaussRadauSteps);
+        }
+    }
+    if (state->integrator == GAUSS_RADAU) {
+        ImGui::SliderFloat("Accuracy", &state->gaussRadauAccuracy, 1e-12f, 1e-4f, "%.0e", ImGuiSliderFlags_Logarithmic);
+        ImGui::Text("Gauss-Radau steps last step: %d", state->lastGaussRadauSteps);
+        ImGui::TextWrapped("Gauss-Radau always uses the direct sum, in double.");
+    }
+    if (state->integrator == HERMITE) {
+        ImGui::TextWrapped("Hermite always uses the direct sum.");
+    }
+    if (state->integrator == WISDOM_HOLMAN) {
+        ImGui::SliderFloat("Encounter Ratio", &state->encounterRatio, 0.005f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+        ImGui::TextWrapped(state->lastEncounter ? "Close encounter (or no dominant body): block step leapfrog"
+                                                : "Kepler orbits around the heaviest body");
+    }
+    ImGui::SliderFloat("Time Step", &state->fixedTimeStep, 0.001f, 1.0f, "%.4f", ImGuiSliderFlags_Logarithmic);
+    ImGui::SliderFloat("Speed", &state->simulationSpeed, 0.1f, 10.0f, "%.2fx", ImGuiSliderFlags_Logarithmic);
+    ImGui::SliderInt("Max Substeps", &state->maxSubsteps, 1, 64);
+    ImGui::Text("Substeps this frame: %d", state->lastSubsteps);
+
+    if (!state->periodicBox) {
+        ImGui::SliderFloat("Fast Forward Time", &state->fastForwardTime, 1.0f, 1000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderInt("Time Slices", &state->pararealSlices, 2, 64);
+        ImGui::SliderInt("Max Iterations", &state->pararealIterations, 1, 16);
+        if (ImGui::Button("Fast Forward (Parareal)")) {
+            fastForward(state, state->fastForwardTime);
+            state->stepAccumulator = 0.0f;
+        }
+        ImGui::Text("Iterations last time: %d", state->lastPararealIterations);
+        ImGui::TextWrapped("Gravity only, nothing collides while fast forwarding.");
+    }
+
+    ImGui::Separator();
+    ImGui::Checkbox("Periodic Box", &state->periodicBox);
+    if (state->periodicBox) {
+        ImGui::SliderFloat("Box Size", &state->boxSize, 1.0f, 200.0f, "%.1f");
+        ImGui::TextWrapped("Periodic runs always use the direct sum.");
+    }
+
+    ImGui::End();
+
+    // --- PHYSICS SETTINGS END ---
+
 
     if (state->selectedBody && state->selectedBody->exists) {
         ImGui::SetNextWindowPos(ImVec2((float)(width - 260), 10), ImGuiCond_FirstUseEver);
@@ -758,7 +940,45 @@ void UpdateFrame(void* arg) {
 
 // Main function: Initialize everything and start the main loop
 
-int main() {
+int main(int argc, char** argv) {
+
+    // Command line options, all read before anything runs so their order doesn't matter
+    int threadCount = defaultThreadCount();
+    const char* headless = nullptr;  // a benchmark to run instead of the window
+    int headlessCount = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threadCount = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0 || strcmp(argv[i], "--parareal") == 0 ||
+                 strcmp(argv[i], "--collisions") == 0 || strcmp(argv[i], "--kepler") == 0) {
+            headless = argv[i];
+            headlessCount = 0;
+            if (i + 1 < argc && argv[i + 1][0] != '-') headlessCount = atoi(argv[++i]);
+        }
+    }
+
+    if (headless) {
+        if (strcmp(headless, "--benchmark") == 0) {
+            // Time the force kernels and exit, no window needed
+            runDirectSumBenchmark(headlessCount > 0 ? headlessCount : 10000);
+        }
+        else if (strcmp(headless, "--parareal") == 0) {
+            // Parareal against the serial fine run, also headless
+            runPararealBenchmark(headlessCount > 0 ? headlessCount : 100, threadCount);
+        }
+        else if (strcmp(headless, "--collisions") == 0) {
+            // The collision broadphases against each other
+            runCollisionBenchmark(headlessCount > 0 ? headlessCount : 10000, threadCount);
+        }
+        else {
+            // The Kepler drift and its fallbacks on random orbits
+            runKeplerBenchmark(headlessCount > 0 ? headlessCount : 100000);
+        }
+        return 0;
+    }
+
     // Initialize GLFW
     if (!glfwInit()) return -1;
 
@@ -860,10 +1080,12 @@ int main() {
     state->gridVBO = gridVBO;
     state->borderVAO = borderVAO;
     state->borderVBO = borderVBO;
+    state->threadCount = threadCount;
 
 
     std::cout << "N-Body Gravity Sim" << std::endl;
     std::cout << "Version: " << VERSION << std::endl;
+    std::cout << "Physics Threads: " << state->threadCount << std::endl;
 
     /*** MAIN LOOP BEGIN ***/
 